@@ -0,0 +1,186 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmarks for src/client.c: the managed-object parse, the per-property
+// cache update and proxy lookup.
+
+#include <stdbool.h>
+
+#include "../src/client.c"
+
+#include "bench.h"
+
+enum VALUE_KIND {
+    VALUE_BOOLEAN = 0,
+    VALUE_INT16,
+    VALUE_STRING,
+    VALUE_OBJECT_PATH,
+    VALUE_STRING_ARRAY,
+    VALUE_DICT,
+    VALUE_NUM
+};
+
+global_variable const char *value_kind_strings[VALUE_NUM] = {"boolean",     "int16",        "string",
+                                                             "object_path", "string_array", "dict"};
+
+typedef struct {
+    GDBusClient *client;
+    DBusMessage *msg;
+    char *path;
+} ClientState;
+
+typedef struct {
+    struct prop_entry *prop;
+    // two different values, so every update replaces the cached one
+    DBusMessage *values[2];
+} PropState;
+
+void bench_parse_managed_objects(GDBusClient *client, DBusMessage *msg) { parse_managed_objects(client, msg); }
+
+void bench_clear_proxies(GDBusClient *client) {
+    g_list_free_full(client->proxy_list, proxy_free);
+    client->proxy_list = NULL;
+}
+
+/** PARSE **/
+
+internal void bench_parse(void *data, u64 iterations) {
+    ClientState *state = data;
+    for (u64 i = 0; i < iterations; i++) {
+        parse_managed_objects(state->client, state->msg);
+        bench_clear_proxies(state->client);
+    }
+}
+
+internal void bench_lookup(void *data, u64 iterations) {
+    ClientState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        g_dbus_proxy_lookup(state->client->proxy_list, NULL, state->path, "org.bluez.Device1");
+}
+
+/** PROPERTY CACHE **/
+
+internal DBusMessage *value_message(u32 kind, u32 variant) {
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    DBusMessageIter iter, array, dict, container, value;
+    const char *uuids[] = {"0000110b-0000-1000-8000-00805f9b34fb", "0000110e-0000-1000-8000-00805f9b34fb",
+                           "0000111e-0000-1000-8000-00805f9b34fb", "0000111f-0000-1000-8000-00805f9b34fb"};
+    const char *string = variant ? "Headphones" : "Headset";
+    const char *path = variant ? "/org/bluez/hci1" : "/org/bluez/hci0";
+    dbus_bool_t boolean = variant;
+    dbus_int16_t rssi = -40 - variant;
+    u8 payload[16] = {variant};
+    const u8 *bytes = payload;
+
+    dbus_message_iter_init_append(msg, &iter);
+    switch (kind) {
+    case VALUE_BOOLEAN:
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &boolean);
+        break;
+    case VALUE_INT16:
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT16, &rssi);
+        break;
+    case VALUE_STRING:
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &string);
+        break;
+    case VALUE_OBJECT_PATH:
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH, &path);
+        break;
+    case VALUE_STRING_ARRAY:
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &array);
+        for (u32 i = 0; i < 3 + variant; i++)
+            dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &uuids[i]);
+        dbus_message_iter_close_container(&iter, &array);
+        break;
+    case VALUE_DICT: {
+        // ManufacturerData: a{qv} with a byte array per company
+        u16 company = 0x004c;
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{qv}", &array);
+        dbus_message_iter_open_container(&array, DBUS_TYPE_DICT_ENTRY, NULL, &dict);
+        dbus_message_iter_append_basic(&dict, DBUS_TYPE_UINT16, &company);
+        dbus_message_iter_open_container(&dict, DBUS_TYPE_VARIANT, "ay", &container);
+        dbus_message_iter_open_container(&container, DBUS_TYPE_ARRAY, "y", &value);
+        dbus_message_iter_append_fixed_array(&value, DBUS_TYPE_BYTE, &bytes, sizeof(payload));
+        dbus_message_iter_close_container(&container, &value);
+        dbus_message_iter_close_container(&dict, &container);
+        dbus_message_iter_close_container(&array, &dict);
+        dbus_message_iter_close_container(&iter, &array);
+        break;
+    }
+    }
+    return msg;
+}
+
+internal void bench_prop_update(void *data, u64 iterations) {
+    PropState *state = data;
+    DBusMessageIter iter;
+    for (u64 i = 0; i < iterations; i++) {
+        dbus_message_iter_init(state->values[i & 1], &iter);
+        prop_entry_update(state->prop, &iter);
+    }
+}
+
+/** SUITE **/
+
+void bench_client_suite(void) {
+    DBusConnection *conn = disconnected_connection();
+    char name[64];
+
+    for (u32 s = 0; s < BENCH_NUM_SIZES; s++) {
+        u32 size = bench_sizes[s];
+        ClientState state = {.client = g_dbus_client_new(conn, "org.bluez", "/org/bluez"),
+                             .msg = bench_managed_objects(size),
+                             .path = bench_device_path(size - 1)};
+
+        g_snprintf(name, sizeof(name), "parse_managed_objects/%u", size);
+        bench_run(name, bench_parse, &state);
+
+        parse_managed_objects(state.client, state.msg);
+        g_snprintf(name, sizeof(name), "g_dbus_proxy_lookup/%u", size);
+        bench_run(name, bench_lookup, &state);
+
+        g_dbus_client_unref(state.client);
+        dbus_message_unref(state.msg);
+        g_free(state.path);
+    }
+
+    for (u32 kind = 0; kind < VALUE_NUM; kind++) {
+        PropState state = {.values = {value_message(kind, 0), value_message(kind, 1)}};
+        DBusMessageIter iter;
+
+        dbus_message_iter_init(state.values[0], &iter);
+        state.prop = prop_entry_new("Value", &iter);
+
+        g_snprintf(name, sizeof(name), "prop_entry_update/%s", value_kind_strings[kind]);
+        bench_run(name, bench_prop_update, &state);
+
+        prop_entry_free(state.prop);
+        dbus_message_unref(state.values[0]);
+        dbus_message_unref(state.values[1]);
+    }
+
+    dbus_connection_unref(conn);
+}
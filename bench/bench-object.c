@@ -0,0 +1,115 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmarks for src/object.c: method dispatch through generic_message, the
+// path every incoming call to an exported object takes.
+
+#include <stdbool.h>
+
+#include "../src/object.c"
+
+#include "bench.h"
+
+#define BENCH_OBJECT_PATH "/org/rofi/bench"
+
+typedef struct {
+    DBusConnection *conn;
+    struct generic_data *data;
+    DBusMessage *msg;
+} ObjectState;
+
+internal DBusMessage *bench_method(DBusConnection *conn, DBusMessage *msg, void *user_data) {
+    return g_dbus_create_reply(msg, DBUS_TYPE_INVALID);
+}
+
+global_variable const GDBusMethodTable bench_methods[] = {
+    {GDBUS_METHOD("Ping", NULL, NULL, bench_method)},
+    {GDBUS_METHOD("Echo", GDBUS_ARGS({"value", "s"}), NULL, bench_method)},
+    {GDBUS_METHOD("Set", GDBUS_ARGS({"name", "s"}, {"value", "v"}), NULL, bench_method)},
+    {GDBUS_METHOD("Get", GDBUS_ARGS({"name", "s"}), NULL, bench_method)},
+    {}};
+
+internal char *bench_interface(u32 index) { return g_strdup_printf("org.rofi.Bench%u", index); }
+
+internal DBusMessage *bench_call(u32 interface_index, const char *member, b32 no_reply) {
+    char *interface = bench_interface(interface_index);
+    DBusMessage *msg = dbus_message_new_method_call(NULL, BENCH_OBJECT_PATH, interface, member);
+    const char *value = "value";
+
+    if (strcmp(member, "Echo") == 0)
+        dbus_message_append_args(msg, DBUS_TYPE_STRING, &value, DBUS_TYPE_INVALID);
+    dbus_message_set_no_reply(msg, no_reply);
+    g_free(interface);
+    return msg;
+}
+
+internal void bench_dispatch(void *data, u64 iterations) {
+    ObjectState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        generic_message(state->conn, state->msg, state->data);
+}
+
+void bench_object_suite(void) {
+    char name[64];
+
+    for (u32 s = 0; s < BENCH_NUM_SIZES; s++) {
+        u32 size = bench_sizes[s];
+        ObjectState state = {.conn = disconnected_connection()};
+
+        for (u32 i = 0; i < size; i++) {
+            char *interface = bench_interface(i);
+            g_dbus_register_interface(state.conn, BENCH_OBJECT_PATH, interface, bench_methods, NULL, NULL, NULL,
+                                      NULL);
+            g_free(interface);
+        }
+        dbus_connection_get_object_path_data(state.conn, BENCH_OBJECT_PATH, (void **)&state.data);
+
+        // reply is built and handed to the (closed) connection
+        state.msg = bench_call(size - 1, "Echo", false);
+        g_snprintf(name, sizeof(name), "generic_message/reply/%u", size);
+        bench_run(name, bench_dispatch, &state);
+        dbus_message_unref(state.msg);
+
+        // reply is built and dropped
+        state.msg = bench_call(size - 1, "Ping", true);
+        g_snprintf(name, sizeof(name), "generic_message/noreply/%u", size);
+        bench_run(name, bench_dispatch, &state);
+        dbus_message_unref(state.msg);
+
+        // signature mismatch: the lookup fails and the call falls through
+        state.msg = bench_call(size - 1, "Set", false);
+        g_snprintf(name, sizeof(name), "generic_message/unknown/%u", size);
+        bench_run(name, bench_dispatch, &state);
+        dbus_message_unref(state.msg);
+
+        for (u32 i = 0; i < size; i++) {
+            char *interface = bench_interface(i);
+            g_dbus_unregister_interface(state.conn, BENCH_OBJECT_PATH, interface);
+            g_free(interface);
+        }
+        dbus_connection_unref(state.conn);
+    }
+}
@@ -0,0 +1,146 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmarks for the plugin's hot paths: handling a full managed-object
+// load, device lookup, rebuilding the entry list in each state and rofi's
+// per-row token match.
+
+#include "../src/bluetooth.c"
+
+#include "bench.h"
+
+global_variable const char *state_strings[] = {"list", "device", "pair", "agent"};
+
+typedef struct {
+    GDBusClient *client;
+    DBusMessage *msg;
+    BluetoothModePrivateData *pd;
+    GDBusProxy *last;
+    rofi_int_matcher **tokens;
+} PluginState;
+
+internal void bench_populate(void *data, u64 iterations) {
+    PluginState *state = data;
+    for (u64 i = 0; i < iterations; i++) {
+        bench_parse_managed_objects(state->client, state->msg);
+        bench_clear_proxies(state->client);
+    }
+}
+
+internal void bench_find_device(void *data, u64 iterations) {
+    PluginState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        find_device(state->last, state->pd->devices, state->pd->num_devices);
+}
+
+internal void bench_update_entries(void *data, u64 iterations) {
+    PluginState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        update_entries(state->pd);
+}
+
+internal void bench_token_match(void *data, u64 iterations) {
+    PluginState *state = data;
+    for (u64 i = 0; i < iterations; i++) {
+        for (u32 j = 0; j < state->pd->num_entries; j++)
+            bluetooth_token_match(&mode, state->tokens, j);
+    }
+}
+
+// The way rofi tokenizes "dev 9": one case-insensitive regex per word.
+internal rofi_int_matcher **tokens_new(const char *input) {
+    char **words = g_strsplit(input, " ", -1);
+    u32 num_words = g_strv_length(words);
+    rofi_int_matcher **tokens = g_malloc0(sizeof(rofi_int_matcher *) * (num_words + 1));
+
+    for (u32 i = 0; i < num_words; i++) {
+        char *escaped = g_regex_escape_string(words[i], -1);
+        tokens[i] = g_malloc0(sizeof(rofi_int_matcher));
+        tokens[i]->regex = g_regex_new(escaped, G_REGEX_CASELESS | G_REGEX_OPTIMIZE, 0, NULL);
+        g_free(escaped);
+    }
+    g_strfreev(words);
+    return tokens;
+}
+
+internal void tokens_free(rofi_int_matcher **tokens) {
+    for (u32 i = 0; tokens[i]; i++) {
+        g_regex_unref(tokens[i]->regex);
+        g_free(tokens[i]);
+    }
+    g_free(tokens);
+}
+
+void bench_plugin_suite(void) {
+    DBusConnection *conn = disconnected_connection();
+    char name[64];
+
+    for (u32 s = 0; s < BENCH_NUM_SIZES; s++) {
+        u32 size = bench_sizes[s];
+        PluginState state = {.client = g_dbus_client_new(conn, "org.bluez", "/org/bluez"),
+                             .msg = bench_managed_objects(size),
+                             .pd = g_malloc0(sizeof(BluetoothModePrivateData)),
+                             .tokens = tokens_new("dev 9")};
+
+        mode_set_private_data(&mode, state.pd);
+        // bluetooth_mode_destroy drops these
+        state.pd->dbus_conn = dbus_connection_ref(conn);
+        state.pd->client = g_dbus_client_ref(state.client);
+        bluetooth_mode_init_state(&mode, state.pd);
+        // measure the lists at full size rather than at the eviction cap
+        state.pd->eviction.max_unpaired = 0;
+
+        g_snprintf(name, sizeof(name), "plugin_populate/%u", size);
+        bench_run(name, bench_populate, &state);
+
+        bench_parse_managed_objects(state.client, state.msg);
+        state.last = state.pd->devices[state.pd->num_devices - 1].remote_proxy;
+
+        g_snprintf(name, sizeof(name), "find_device/%u", size);
+        bench_run(name, bench_find_device, &state);
+
+        for (u32 st = LIST; st <= AGENT; st++) {
+            state.pd->state = st;
+            state.pd->current_device = 0;
+            state.pd->agent.request = AGENT_REQUEST_CONFIRMATION;
+            g_snprintf(name, sizeof(name), "update_entries/%s/%u", state_strings[st], size);
+            bench_run(name, bench_update_entries, &state);
+        }
+
+        state.pd->state = PAIR;
+        update_entries(state.pd);
+        g_snprintf(name, sizeof(name), "bluetooth_token_match/%u", size);
+        bench_run(name, bench_token_match, &state);
+
+        state.pd->state = LIST;
+        g_dbus_client_unref(state.client);
+        bluetooth_mode_destroy(&mode);
+        dbus_message_unref(state.msg);
+        tokens_free(state.tokens);
+    }
+
+    dbus_connection_unref(conn);
+}
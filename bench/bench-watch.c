@@ -0,0 +1,127 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Benchmarks for src/watch.c: how message_filter scales with the number of
+// signal watches, which grows by one PropertiesChanged watch per proxy.
+
+#include <stdbool.h>
+
+#include "../src/watch.c"
+
+#include "bench.h"
+
+typedef struct {
+    DBusConnection *conn;
+    DBusMessage *hit;
+    DBusMessage *miss;
+    u64 calls;
+} WatchState;
+
+internal gboolean bench_signal(DBusConnection *conn, DBusMessage *msg, void *user_data) {
+    WatchState *state = user_data;
+    state->calls++;
+    return TRUE;
+}
+
+internal DBusMessage *bench_properties_changed(const char *path) {
+    DBusMessage *msg = dbus_message_new_signal(path, DBUS_INTERFACE_PROPERTIES, "PropertiesChanged");
+    const char *interface = "org.bluez.Device1";
+    DBusMessageIter iter, container;
+
+    dbus_message_iter_init_append(msg, &iter);
+    dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &interface);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &container);
+    dbus_message_iter_close_container(&iter, &container);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s", &container);
+    dbus_message_iter_close_container(&iter, &container);
+    return msg;
+}
+
+// Builds the watch the same way g_dbus_add_properties_watch does, minus the
+// AddMatch round trip, which the disconnected connection cannot make.
+internal struct filter_callback *bench_add_watch(WatchState *state, const char *path) {
+    struct filter_data *data = memstat_alloc0(MEMSTAT_WATCH, sizeof(*data));
+
+    data->connection = dbus_connection_ref(state->conn);
+    data->handle_func = signal_filter;
+    data->path = memstat_strdup(MEMSTAT_WATCH, path);
+    data->interface = memstat_strdup(MEMSTAT_WATCH, DBUS_INTERFACE_PROPERTIES);
+    data->member = memstat_strdup(MEMSTAT_WATCH, "PropertiesChanged");
+    listeners = g_slist_append(listeners, data);
+
+    return filter_data_add_callback(data, NULL, NULL, bench_signal, NULL, state);
+}
+
+internal void bench_filter_hit(void *data, u64 iterations) {
+    WatchState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        message_filter(state->conn, state->hit, NULL);
+}
+
+internal void bench_filter_miss(void *data, u64 iterations) {
+    WatchState *state = data;
+    for (u64 i = 0; i < iterations; i++)
+        message_filter(state->conn, state->miss, NULL);
+}
+
+void bench_watch_suite(void) {
+    char name[64];
+
+    for (u32 s = 0; s < BENCH_NUM_SIZES; s++) {
+        u32 size = bench_sizes[s];
+        WatchState state = {.conn = disconnected_connection()};
+        GSList *watches = NULL;
+
+        // filter_data_free removes message_filter once the last watch goes
+        dbus_connection_add_filter(state.conn, message_filter, NULL, NULL);
+
+        for (u32 i = 0; i < size; i++) {
+            char *path = bench_device_path(i);
+            watches = g_slist_prepend(watches, bench_add_watch(&state, path));
+            g_free(path);
+        }
+
+        char *path = bench_device_path(size - 1);
+        state.hit = bench_properties_changed(path);
+        g_free(path);
+        path = bench_device_path(size);
+        state.miss = bench_properties_changed(path);
+        g_free(path);
+
+        g_snprintf(name, sizeof(name), "message_filter/hit/%u", size);
+        bench_run(name, bench_filter_hit, &state);
+        g_snprintf(name, sizeof(name), "message_filter/miss/%u", size);
+        bench_run(name, bench_filter_miss, &state);
+
+        for (GSList *l = watches; l; l = l->next)
+            g_dbus_remove_watch(state.conn, ((struct filter_callback *)l->data)->id);
+        g_slist_free(watches);
+
+        dbus_message_unref(state.hit);
+        dbus_message_unref(state.miss);
+        dbus_connection_unref(state.conn);
+    }
+}
@@ -0,0 +1,219 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// bench runs the microbenchmarks and prints one JSON object per line:
+//
+//   {"bench":"parse_managed_objects/100","iterations":..,"ns_per_op":..,
+//    "min_ns_per_op":..,"allocs_per_op":..,"bytes_per_op":..,"peak_rss_kb":..}
+//
+// ns_per_op is the median of BENCH_SAMPLES runs of at least BENCH_MIN_NS
+// each. Allocations are counted by wrapping glibc's malloc family, so they
+// include GLib and libdbus. An optional argument only runs benchmarks whose
+// name contains it.
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define BENCH_MIN_NS (50 * 1000 * 1000)
+#define BENCH_SAMPLES 5
+
+const u32 bench_sizes[BENCH_NUM_SIZES] = {10, 100, 1000};
+
+global_variable const char *bench_filter;
+global_variable u64 bench_allocations;
+global_variable u64 bench_allocated_bytes;
+
+/** ALLOCATIONS **/
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    bench_allocations++;
+    bench_allocated_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    bench_allocations++;
+    bench_allocated_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    bench_allocations++;
+    bench_allocated_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+/** HARNESS **/
+
+internal u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+internal int compare_f64(const void *a, const void *b) {
+    f64 x = *(const f64 *)a, y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+b32 bench_selected(const char *name) { return bench_filter == NULL || strstr(name, bench_filter) != NULL; }
+
+void bench_run(const char *name, BenchFunction function, void *state) {
+    f64 samples[BENCH_SAMPLES];
+    u64 iterations = 1, allocations = 0, bytes = 0;
+    struct rusage usage;
+
+    if (!bench_selected(name))
+        return;
+
+    function(state, 1);
+
+    // grow the batch until one sample takes BENCH_MIN_NS
+    for (;;) {
+        u64 start = now_ns();
+        function(state, iterations);
+        u64 elapsed = now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS)
+            break;
+        iterations = elapsed ? MAX(iterations + 1, iterations * BENCH_MIN_NS / elapsed) : iterations * 16;
+    }
+
+    for (u32 i = 0; i < BENCH_SAMPLES; i++) {
+        u64 allocations_start = bench_allocations, bytes_start = bench_allocated_bytes;
+        u64 start = now_ns();
+        function(state, iterations);
+        samples[i] = (f64)(now_ns() - start) / iterations;
+        allocations = bench_allocations - allocations_start;
+        bytes = bench_allocated_bytes - bytes_start;
+    }
+    qsort(samples, BENCH_SAMPLES, sizeof(f64), compare_f64);
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("{\"bench\":\"%s\",\"iterations\":%" G_GUINT64_FORMAT ",\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,"
+           "\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f,\"peak_rss_kb\":%ld}\n",
+           name, iterations, samples[BENCH_SAMPLES / 2], samples[0], (f64)allocations / iterations,
+           (f64)bytes / iterations, usage.ru_maxrss);
+    fflush(stdout);
+}
+
+/** FIXTURES **/
+
+char *bench_device_path(u32 index) {
+    return g_strdup_printf("/org/bluez/hci0/dev_%02X_%02X_%02X_00_00_00", (index >> 16) & 0xff, (index >> 8) & 0xff,
+                           index & 0xff);
+}
+
+internal void open_object(DBusMessageIter *objects, DBusMessageIter *object, DBusMessageIter *interfaces,
+                          DBusMessageIter *interface, DBusMessageIter *properties, const char *path,
+                          const char *name) {
+    dbus_message_iter_open_container(objects, DBUS_TYPE_DICT_ENTRY, NULL, object);
+    dbus_message_iter_append_basic(object, DBUS_TYPE_OBJECT_PATH, &path);
+    dbus_message_iter_open_container(object, DBUS_TYPE_ARRAY, "{sa{sv}}", interfaces);
+    dbus_message_iter_open_container(interfaces, DBUS_TYPE_DICT_ENTRY, NULL, interface);
+    dbus_message_iter_append_basic(interface, DBUS_TYPE_STRING, &name);
+    dbus_message_iter_open_container(interface, DBUS_TYPE_ARRAY, "{sv}", properties);
+}
+
+internal void close_object(DBusMessageIter *objects, DBusMessageIter *object, DBusMessageIter *interfaces,
+                           DBusMessageIter *interface, DBusMessageIter *properties) {
+    dbus_message_iter_close_container(interface, properties);
+    dbus_message_iter_close_container(interfaces, interface);
+    dbus_message_iter_close_container(object, interfaces);
+    dbus_message_iter_close_container(objects, object);
+}
+
+// One powered adapter and num_devices devices under it: every third one
+// paired, every twelfth one connected, all with RSSI and a few UUIDs.
+DBusMessage *bench_managed_objects(u32 num_devices) {
+    DBusMessage *msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    DBusMessageIter iter, objects, object, interfaces, interface, properties;
+    const char *uuids[] = {"0000110b-0000-1000-8000-00805f9b34fb", "0000110e-0000-1000-8000-00805f9b34fb",
+                           "0000111e-0000-1000-8000-00805f9b34fb"};
+    const char *adapter = "/org/bluez/hci0", *adapter_address = "00:1A:7D:DA:71:13", *adapter_name = "hci0";
+    const char *icon = "audio-headset";
+    dbus_bool_t yes = true, no = false;
+
+    dbus_message_iter_init_append(msg, &iter);
+    dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{oa{sa{sv}}}", &objects);
+
+    open_object(&objects, &object, &interfaces, &interface, &properties, adapter, "org.bluez.Adapter1");
+    g_dbus_dict_append_entry(&properties, "Address", DBUS_TYPE_STRING, &adapter_address);
+    g_dbus_dict_append_entry(&properties, "Alias", DBUS_TYPE_STRING, &adapter_name);
+    g_dbus_dict_append_entry(&properties, "Powered", DBUS_TYPE_BOOLEAN, &yes);
+    g_dbus_dict_append_entry(&properties, "Discoverable", DBUS_TYPE_BOOLEAN, &no);
+    g_dbus_dict_append_entry(&properties, "Discovering", DBUS_TYPE_BOOLEAN, &yes);
+    close_object(&objects, &object, &interfaces, &interface, &properties);
+
+    for (u32 i = 0; i < num_devices; i++) {
+        char *path = bench_device_path(i);
+        char *address = g_strdup_printf("%02X:%02X:%02X:00:00:00", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+        char *name = g_strdup_printf("Device %u", i);
+        dbus_bool_t paired = i % 3 == 0, connected = i % 12 == 0;
+        dbus_int16_t rssi = -40 - (i % 50);
+        const char **uuid_list = uuids;
+
+        open_object(&objects, &object, &interfaces, &interface, &properties, path, "org.bluez.Device1");
+        g_dbus_dict_append_entry(&properties, "Address", DBUS_TYPE_STRING, &address);
+        g_dbus_dict_append_entry(&properties, "Alias", DBUS_TYPE_STRING, &name);
+        g_dbus_dict_append_entry(&properties, "Icon", DBUS_TYPE_STRING, &icon);
+        g_dbus_dict_append_entry(&properties, "Paired", DBUS_TYPE_BOOLEAN, &paired);
+        g_dbus_dict_append_entry(&properties, "Connected", DBUS_TYPE_BOOLEAN, &connected);
+        g_dbus_dict_append_entry(&properties, "Trusted", DBUS_TYPE_BOOLEAN, &paired);
+        g_dbus_dict_append_entry(&properties, "RSSI", DBUS_TYPE_INT16, &rssi);
+        g_dbus_dict_append_entry(&properties, "Adapter", DBUS_TYPE_OBJECT_PATH, &adapter);
+        g_dbus_dict_append_array(&properties, "UUIDs", DBUS_TYPE_STRING, &uuid_list, G_N_ELEMENTS(uuids));
+        close_object(&objects, &object, &interfaces, &interface, &properties);
+
+        g_free(path);
+        g_free(address);
+        g_free(name);
+    }
+
+    dbus_message_iter_close_container(&iter, &objects);
+    return msg;
+}
+
+int main(int argc, char **argv) {
+    bench_filter = argc > 1 ? argv[1] : NULL;
+
+    bench_client_suite();
+    bench_plugin_suite();
+    bench_watch_suite();
+    bench_object_suite();
+    return 0;
+}
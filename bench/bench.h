@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+
+// Each suite lives in its own translation unit because it includes the
+// source file it measures to reach its internal functions.
+
+#define BENCH_NUM_SIZES 3
+
+// A benchmark body performs its operation `iterations` times.
+typedef void (*BenchFunction)(void *state, u64 iterations);
+
+extern const u32 bench_sizes[BENCH_NUM_SIZES];
+
+b32 bench_selected(const char *name);
+void bench_run(const char *name, BenchFunction function, void *state);
+
+// from fuzz/rofi-stubs.c, shared with the fuzz targets
+DBusConnection *disconnected_connection(void);
+char *bench_device_path(u32 index);
+DBusMessage *bench_managed_objects(u32 num_devices);
+
+// from bench-client.c, for suites that need a populated client
+void bench_parse_managed_objects(GDBusClient *client, DBusMessage *msg);
+void bench_clear_proxies(GDBusClient *client);
+
+void bench_client_suite(void);
+void bench_plugin_suite(void);
+void bench_watch_suite(void);
+void bench_object_suite(void);
+
+#endif
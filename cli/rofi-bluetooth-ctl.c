@@ -0,0 +1,473 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// rofi-bluetooth-ctl answers one query against BlueZ and exits, for scripts
+// that would otherwise scrape bluetoothctl:
+//
+//   rofi-bluetooth-ctl paired
+//   rofi-bluetooth-ctl status AA:BB:CC:DD:EE:FF
+//   rofi-bluetooth-ctl connect AA:BB:CC:DD:EE:FF
+//
+// With --batch, one command per line is read from stdin. Every query is
+// answered from the single GetManagedObjects snapshot and every connect /
+// disconnect is sent at once, so N commands cost one round trip rather than
+// N. Output keeps the order of the input. --time adds per-command and total
+// timings on stderr.
+//
+// With --shm, queries are answered from the segment rofi-bluetoothd publishes
+// (include/shm.h) without touching the bus at all; connect and disconnect
+// still need BlueZ and fail in that mode.
+
+#define G_LOG_DOMAIN "BluetoothCtl"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+#include "shm.h"
+
+#define READY_TIMEOUT_MS 5000
+
+enum COMMAND {
+    COMMAND_PAIRED = 0,
+    COMMAND_ADAPTERS,
+    COMMAND_STATUS,
+    COMMAND_CONNECT,
+    COMMAND_DISCONNECT,
+    COMMAND_NUM
+};
+
+global_variable const char *command_strings[COMMAND_NUM] = {"paired", "adapters", "status", "connect", "disconnect"};
+
+typedef struct {
+    u32 type;
+    char *address;
+    GString *output;
+    b32 failed;
+    b32 done;
+    i64 start;
+    i64 end;
+} Command;
+
+global_variable struct {
+    GMainLoop *loop;
+    GList *devices;
+    GList *adapters;
+    GPtrArray *commands;
+    u32 outstanding;
+    u32 failed;
+    b32 timing;
+    guint timeout;
+    i64 start;
+    i64 ready;
+} ctl;
+
+/** PROPERTIES **/
+
+internal const char *proxy_string(GDBusProxy *proxy, const char *property) {
+    DBusMessageIter iter;
+    const char *value = NULL;
+
+    if (g_dbus_proxy_get_property(proxy, property, &iter))
+        dbus_message_iter_get_basic(&iter, &value);
+    return value ? value : "";
+}
+
+internal b32 proxy_flag(GDBusProxy *proxy, const char *property) {
+    DBusMessageIter iter;
+    dbus_bool_t value = false;
+
+    if (g_dbus_proxy_get_property(proxy, property, &iter))
+        dbus_message_iter_get_basic(&iter, &value);
+    return value;
+}
+
+internal GDBusProxy *find_device(const char *address) {
+    for (GList *l = ctl.devices; l; l = l->next) {
+        if (!g_ascii_strcasecmp(proxy_string(l->data, "Address"), address))
+            return l->data;
+    }
+    return NULL;
+}
+
+/** COMMANDS **/
+
+internal Command *command_parse(const char *line) {
+    char **argv = g_strsplit_set(line, " \t", -1);
+    char **args = argv;
+    Command *cmd = NULL;
+
+    while (*args && **args == '\0')
+        args++;
+    if (*args == NULL)
+        goto out;
+
+    for (u32 type = 0; type < COMMAND_NUM; type++) {
+        if (strcmp(*args, command_strings[type]))
+            continue;
+        b32 needs_address = type >= COMMAND_STATUS;
+        char *address = args[1];
+        if (needs_address && (address == NULL || *address == '\0')) {
+            fprintf(stderr, "%s: expected an address\n", *args);
+            goto out;
+        }
+        cmd = g_malloc0(sizeof(Command));
+        cmd->type = type;
+        cmd->address = needs_address ? g_strdup(address) : NULL;
+        cmd->output = g_string_new(NULL);
+        goto out;
+    }
+    fprintf(stderr, "unknown command: %s\n", *args);
+
+out:
+    g_strfreev(argv);
+    return cmd;
+}
+
+internal void command_free(gpointer data) {
+    Command *cmd = data;
+    g_free(cmd->address);
+    g_string_free(cmd->output, true);
+    g_free(cmd);
+}
+
+internal void command_finish(Command *cmd, b32 failed) {
+    cmd->done = true;
+    cmd->failed = failed;
+    cmd->end = g_get_monotonic_time();
+    if (failed)
+        ctl.failed++;
+}
+
+internal void print_results(void) {
+    for (u32 i = 0; i < ctl.commands->len; i++) {
+        Command *cmd = g_ptr_array_index(ctl.commands, i);
+        fputs(cmd->output->str, stdout);
+        if (ctl.timing) {
+            fprintf(stderr, "%s%s%s: %.2fms\n", command_strings[cmd->type], cmd->address ? " " : "",
+                    cmd->address ? cmd->address : "", (cmd->end - cmd->start) / 1e3);
+        }
+    }
+    fflush(stdout);
+    if (ctl.timing) {
+        i64 now = g_get_monotonic_time();
+        fprintf(stderr, "objects: %.2fms, total: %.2fms, %u commands, %u failed\n", (ctl.ready - ctl.start) / 1e3,
+                (now - ctl.start) / 1e3, ctl.commands->len, ctl.failed);
+    }
+}
+
+internal void method_reply(DBusMessage *message, void *user_data) {
+    Command *cmd = user_data;
+    DBusError err;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_string_append_printf(cmd->output, "%s %s: failed: %s\n", command_strings[cmd->type], cmd->address,
+                               err.message);
+        dbus_error_free(&err);
+        command_finish(cmd, true);
+    } else {
+        g_string_append_printf(cmd->output, "%s %s: ok\n", command_strings[cmd->type], cmd->address);
+        command_finish(cmd, false);
+    }
+
+    if (--ctl.outstanding == 0)
+        g_main_loop_quit(ctl.loop);
+}
+
+internal void command_run(Command *cmd) {
+    GDBusProxy *proxy = NULL;
+
+    cmd->start = g_get_monotonic_time();
+    switch (cmd->type) {
+    case COMMAND_PAIRED:
+        for (GList *l = ctl.devices; l; l = l->next) {
+            if (!proxy_flag(l->data, "Paired"))
+                continue;
+            g_string_append_printf(cmd->output, "%s %s %s\n", proxy_string(l->data, "Address"),
+                                   proxy_flag(l->data, "Connected") ? "connected" : "disconnected",
+                                   proxy_string(l->data, "Alias"));
+        }
+        command_finish(cmd, false);
+        return;
+    case COMMAND_ADAPTERS:
+        for (GList *l = ctl.adapters; l; l = l->next) {
+            g_string_append_printf(cmd->output, "%s %s %s\n", proxy_string(l->data, "Address"),
+                                   proxy_flag(l->data, "Powered") ? "on" : "off", proxy_string(l->data, "Alias"));
+        }
+        command_finish(cmd, false);
+        return;
+    default:
+        break;
+    }
+
+    proxy = find_device(cmd->address);
+    if (proxy == NULL) {
+        g_string_append_printf(cmd->output, "%s %s: no such device\n", command_strings[cmd->type], cmd->address);
+        command_finish(cmd, true);
+        return;
+    }
+
+    if (cmd->type == COMMAND_STATUS) {
+        g_string_append_printf(cmd->output, "%s paired=%s connected=%s trusted=%s name=%s\n",
+                               proxy_string(proxy, "Address"), proxy_flag(proxy, "Paired") ? "yes" : "no",
+                               proxy_flag(proxy, "Connected") ? "yes" : "no",
+                               proxy_flag(proxy, "Trusted") ? "yes" : "no", proxy_string(proxy, "Alias"));
+        command_finish(cmd, false);
+        return;
+    }
+
+    const char *method = cmd->type == COMMAND_CONNECT ? "Connect" : "Disconnect";
+    if (!g_dbus_proxy_method_call(proxy, method, NULL, method_reply, cmd, NULL)) {
+        g_string_append_printf(cmd->output, "%s %s: failed to send\n", command_strings[cmd->type], cmd->address);
+        command_finish(cmd, true);
+        return;
+    }
+    ctl.outstanding++;
+}
+
+/** SHARED MEMORY **/
+
+internal b32 shm_load(ShmSnapshot *copy) {
+    char *name = shm_snapshot_name();
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    b32 ok = false;
+
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s (is rofi-bluetoothd running?)\n", name, strerror(errno));
+        g_free(name);
+        return false;
+    }
+    void *map = mmap(NULL, sizeof(ShmSnapshot), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+    } else {
+        ok = shm_snapshot_read(map, copy);
+        if (!ok)
+            fprintf(stderr, "%s: no consistent snapshot\n", name);
+        munmap(map, sizeof(ShmSnapshot));
+    }
+    g_free(name);
+    return ok;
+}
+
+internal void shm_command_run(Command *cmd, const ShmSnapshot *shm) {
+    const ShmRecord *device = NULL;
+
+    cmd->start = g_get_monotonic_time();
+    switch (cmd->type) {
+    case COMMAND_PAIRED:
+        for (u32 i = 0; i < shm->num_devices; i++) {
+            const ShmRecord *record = &shm->devices[i];
+            if (!(record->flags & SHM_FLAG_PAIRED))
+                continue;
+            g_string_append_printf(cmd->output, "%s %s %s\n", record->address,
+                                   (record->flags & SHM_FLAG_CONNECTED) ? "connected" : "disconnected", record->name);
+        }
+        command_finish(cmd, false);
+        return;
+    case COMMAND_ADAPTERS:
+        for (u32 i = 0; i < shm->num_adapters; i++) {
+            const ShmRecord *record = &shm->adapters[i];
+            g_string_append_printf(cmd->output, "%s %s %s\n", record->address,
+                                   (record->flags & SHM_FLAG_POWERED) ? "on" : "off", record->name);
+        }
+        command_finish(cmd, false);
+        return;
+    case COMMAND_STATUS:
+        break;
+    default:
+        g_string_append_printf(cmd->output, "%s %s: not available with --shm\n", command_strings[cmd->type],
+                               cmd->address);
+        command_finish(cmd, true);
+        return;
+    }
+
+    for (u32 i = 0; i < shm->num_devices && device == NULL; i++) {
+        if (!g_ascii_strcasecmp(shm->devices[i].address, cmd->address))
+            device = &shm->devices[i];
+    }
+    if (device == NULL) {
+        g_string_append_printf(cmd->output, "%s %s: no such device\n", command_strings[cmd->type], cmd->address);
+        command_finish(cmd, true);
+        return;
+    }
+    g_string_append_printf(cmd->output, "%s paired=%s connected=%s trusted=%s name=%s\n", device->address,
+                           (device->flags & SHM_FLAG_PAIRED) ? "yes" : "no",
+                           (device->flags & SHM_FLAG_CONNECTED) ? "yes" : "no",
+                           (device->flags & SHM_FLAG_TRUSTED) ? "yes" : "no", device->name);
+    command_finish(cmd, false);
+}
+
+// The whole query runs against one local copy, so there is no main loop and
+// no D-Bus connection in this mode.
+internal int shm_main(void) {
+    ShmSnapshot shm;
+
+    if (!shm_load(&shm))
+        return 1;
+    ctl.ready = g_get_monotonic_time();
+    for (u32 i = 0; i < ctl.commands->len; i++)
+        shm_command_run(g_ptr_array_index(ctl.commands, i), &shm);
+    print_results();
+
+    int status = ctl.failed ? 1 : 0;
+    g_ptr_array_free(ctl.commands, true);
+    return status;
+}
+
+/** ENGINE **/
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    const char *interface = g_dbus_proxy_get_interface(proxy);
+
+    if (!strcmp(interface, "org.bluez.Device1"))
+        ctl.devices = g_list_append(ctl.devices, proxy);
+    else if (!strcmp(interface, "org.bluez.Adapter1"))
+        ctl.adapters = g_list_append(ctl.adapters, proxy);
+}
+
+internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
+    ctl.devices = g_list_remove(ctl.devices, proxy);
+    ctl.adapters = g_list_remove(ctl.adapters, proxy);
+}
+
+internal void client_ready(GDBusClient *client, void *user_data) {
+    ctl.ready = g_get_monotonic_time();
+    // connects may legitimately take longer than the wait for BlueZ itself
+    g_source_remove(ctl.timeout);
+    ctl.timeout = 0;
+    for (u32 i = 0; i < ctl.commands->len; i++)
+        command_run(g_ptr_array_index(ctl.commands, i));
+
+    if (ctl.outstanding == 0)
+        g_main_loop_quit(ctl.loop);
+}
+
+internal gboolean ready_timeout(gpointer user_data) {
+    fprintf(stderr, "timed out waiting for org.bluez\n");
+    ctl.timeout = 0;
+    ctl.failed++;
+    g_main_loop_quit(ctl.loop);
+    return G_SOURCE_REMOVE;
+}
+
+/** SETUP **/
+
+internal void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [--time] [--shm] COMMAND [ADDRESS]\n"
+            "       %s [--time] [--shm] --batch < commands\n"
+            "commands: paired, adapters, status ADDRESS, connect ADDRESS, disconnect ADDRESS\n",
+            name, name);
+}
+
+int main(int argc, char **argv) {
+    b32 batch = false;
+    b32 shm = false;
+    int i = 1;
+
+    ctl.start = g_get_monotonic_time();
+    ctl.commands = g_ptr_array_new_with_free_func(command_free);
+
+    for (; i < argc && g_str_has_prefix(argv[i], "--"); i++) {
+        if (!strcmp(argv[i], "--batch")) {
+            batch = true;
+        } else if (!strcmp(argv[i], "--time")) {
+            ctl.timing = true;
+        } else if (!strcmp(argv[i], "--shm")) {
+            shm = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (batch) {
+        char line[256];
+        while (fgets(line, sizeof(line), stdin)) {
+            g_strstrip(line);
+            if (*line == '\0' || *line == '#')
+                continue;
+            Command *cmd = command_parse(line);
+            if (cmd == NULL)
+                return 2;
+            g_ptr_array_add(ctl.commands, cmd);
+        }
+    } else if (i < argc) {
+        char *line = g_strjoinv(" ", argv + i);
+        Command *cmd = command_parse(line);
+        g_free(line);
+        if (cmd == NULL)
+            return 2;
+        g_ptr_array_add(ctl.commands, cmd);
+    }
+
+    if (ctl.commands->len == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (shm)
+        return shm_main();
+
+    DBusConnection *dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
+    if (dbus_conn == NULL) {
+        fprintf(stderr, "unable to connect to the system bus\n");
+        return 1;
+    }
+
+    ctl.loop = g_main_loop_new(NULL, false);
+
+    GDBusClient *client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
+    g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed, NULL, NULL);
+    g_dbus_client_set_ready_watch(client, client_ready, NULL);
+
+    ctl.timeout = g_timeout_add(READY_TIMEOUT_MS, ready_timeout, NULL);
+    g_main_loop_run(ctl.loop);
+    if (ctl.timeout)
+        g_source_remove(ctl.timeout);
+
+    print_results();
+
+    int status = ctl.failed ? 1 : 0;
+    g_dbus_client_unref(client);
+    dbus_connection_unref(dbus_conn);
+    g_list_free(ctl.devices);
+    g_list_free(ctl.adapters);
+    g_ptr_array_free(ctl.commands, true);
+    g_main_loop_unref(ctl.loop);
+    return status;
+}
@@ -0,0 +1,337 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// rofi-bluetooth-events prints one JSON object per line whenever an adapter,
+// a paired device or its battery changes, for status bars to consume:
+//
+//   {"event":"changed","kind":"device","path":"/org/bluez/hci0/dev_..",
+//    "address":"..","name":"..","connected":true,"paired":true,...}
+//
+// Options:
+//   --fields=name,connected,...  only print these fields (event, kind and
+//                                path are always printed)
+//   --debounce=MS                coalesce changes per object (default 100)
+//   --all                        include unpaired devices
+
+#define G_LOG_DOMAIN "BluetoothEvents"
+
+#include <glib-unix.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+
+#define DEFAULT_DEBOUNCE_MS 100
+
+enum FIELD {
+    FIELD_ADDRESS = 1 << 0,
+    FIELD_NAME = 1 << 1,
+    FIELD_CONNECTED = 1 << 2,
+    FIELD_PAIRED = 1 << 3,
+    FIELD_TRUSTED = 1 << 4,
+    FIELD_BATTERY = 1 << 5,
+    FIELD_POWERED = 1 << 6,
+    FIELD_DISCOVERABLE = 1 << 7,
+    FIELD_DISCOVERING = 1 << 8,
+    FIELD_ALL = (1 << 9) - 1
+};
+
+global_variable const char *field_names[] = {"address", "name",     "connected",    "paired",     "trusted",
+                                             "battery", "powered", "discoverable", "discovering"};
+
+// Properties worth waking up for; anything else (RSSI, ManufacturerData,
+// ...) is ignored before it reaches the debounce timer.
+global_variable const char *watched_properties[] = {"Address", "Alias",    "Connected",    "Paired",     "Trusted",
+                                                    "Percentage", "Powered", "Discoverable", "Discovering"};
+
+enum KIND { KIND_DEVICE = 0, KIND_ADAPTER };
+
+typedef struct {
+    char *path;
+    GDBusProxy *proxy;
+    GDBusProxy *battery;
+    u32 kind;
+    // pending debounce timer, so a chatty device cannot delay everyone else
+    guint flush;
+    // the last line printed, so repeats collapse to nothing
+    char *last;
+} Entity;
+
+global_variable struct {
+    GMainLoop *loop;
+    GHashTable *entities;
+    u32 fields;
+    u32 debounce_ms;
+    b32 all_devices;
+} events = {.fields = FIELD_ALL, .debounce_ms = DEFAULT_DEBOUNCE_MS};
+
+/** OUTPUT **/
+
+internal void json_string(GString *out, const char *str) {
+    g_string_append_c(out, '"');
+    for (const char *p = str; *p; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\')
+            g_string_append_printf(out, "\\%c", c);
+        else if (c < 0x20)
+            g_string_append_printf(out, "\\u%04x", c);
+        else
+            g_string_append_c(out, c);
+    }
+    g_string_append_c(out, '"');
+}
+
+internal void json_bool_field(GString *out, GDBusProxy *proxy, const char *property, u32 field) {
+    DBusMessageIter iter;
+    dbus_bool_t value;
+
+    if (!(events.fields & field) || proxy == NULL || !g_dbus_proxy_get_property(proxy, property, &iter))
+        return;
+    dbus_message_iter_get_basic(&iter, &value);
+    g_string_append_printf(out, ",\"%s\":%s", field_names[__builtin_ctz(field)], value ? "true" : "false");
+}
+
+internal void json_string_field(GString *out, GDBusProxy *proxy, const char *property, u32 field) {
+    DBusMessageIter iter;
+    const char *value;
+
+    if (!(events.fields & field) || proxy == NULL || !g_dbus_proxy_get_property(proxy, property, &iter))
+        return;
+    dbus_message_iter_get_basic(&iter, &value);
+    g_string_append_printf(out, ",\"%s\":", field_names[__builtin_ctz(field)]);
+    json_string(out, value);
+}
+
+internal b32 entity_paired(Entity *entity) {
+    DBusMessageIter iter;
+    dbus_bool_t paired = false;
+
+    if (entity->proxy && g_dbus_proxy_get_property(entity->proxy, "Paired", &iter))
+        dbus_message_iter_get_basic(&iter, &paired);
+    return paired;
+}
+
+internal void entity_print(Entity *entity, const char *event) {
+    GString *line = g_string_new("{\"event\":");
+
+    json_string(line, event);
+    g_string_append_printf(line, ",\"kind\":\"%s\",\"path\":", entity->kind == KIND_ADAPTER ? "adapter" : "device");
+    json_string(line, entity->path);
+
+    if (entity->kind == KIND_ADAPTER) {
+        json_string_field(line, entity->proxy, "Address", FIELD_ADDRESS);
+        json_string_field(line, entity->proxy, "Alias", FIELD_NAME);
+        json_bool_field(line, entity->proxy, "Powered", FIELD_POWERED);
+        json_bool_field(line, entity->proxy, "Discoverable", FIELD_DISCOVERABLE);
+        json_bool_field(line, entity->proxy, "Discovering", FIELD_DISCOVERING);
+    } else {
+        DBusMessageIter iter;
+        json_string_field(line, entity->proxy, "Address", FIELD_ADDRESS);
+        json_string_field(line, entity->proxy, "Alias", FIELD_NAME);
+        json_bool_field(line, entity->proxy, "Connected", FIELD_CONNECTED);
+        json_bool_field(line, entity->proxy, "Paired", FIELD_PAIRED);
+        json_bool_field(line, entity->proxy, "Trusted", FIELD_TRUSTED);
+        if ((events.fields & FIELD_BATTERY) && entity->battery &&
+            g_dbus_proxy_get_property(entity->battery, "Percentage", &iter)) {
+            u8 percentage;
+            dbus_message_iter_get_basic(&iter, &percentage);
+            g_string_append_printf(line, ",\"battery\":%u", percentage);
+        }
+    }
+    g_string_append_c(line, '}');
+
+    // "changed" lines identical to the previous one carry no news
+    if (!strcmp(event, "changed") && entity->last && !strcmp(entity->last, line->str)) {
+        g_string_free(line, true);
+        return;
+    }
+    puts(line->str);
+    fflush(stdout);
+    g_free(entity->last);
+    entity->last = g_string_free(line, false);
+}
+
+/** DEBOUNCE **/
+
+internal gboolean entity_flush(gpointer user_data) {
+    Entity *entity = user_data;
+
+    entity->flush = 0;
+    if (entity->proxy == NULL)
+        return G_SOURCE_REMOVE;
+    if (events.all_devices || entity->kind == KIND_ADAPTER || entity_paired(entity)) {
+        entity_print(entity, "changed");
+    } else if (entity->last) {
+        // a device we reported was unpaired: say so once, then go quiet
+        entity_print(entity, "changed");
+        g_clear_pointer(&entity->last, g_free);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+internal void entity_touch(Entity *entity) {
+    if (!entity->flush)
+        entity->flush = g_timeout_add(events.debounce_ms, entity_flush, entity);
+}
+
+/** ENGINE **/
+
+internal Entity *entity_get(const char *path) {
+    Entity *entity = g_hash_table_lookup(events.entities, path);
+    if (entity == NULL) {
+        entity = g_malloc0(sizeof(Entity));
+        entity->path = g_strdup(path);
+        g_hash_table_insert(events.entities, entity->path, entity);
+    }
+    return entity;
+}
+
+internal void entity_free(gpointer data) {
+    Entity *entity = data;
+    if (entity->flush)
+        g_source_remove(entity->flush);
+    g_free(entity->path);
+    g_free(entity->last);
+    g_free(entity);
+}
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    const char *interface = g_dbus_proxy_get_interface(proxy);
+    Entity *entity;
+
+    if (!strcmp(interface, "org.bluez.Device1") || !strcmp(interface, "org.bluez.Adapter1")) {
+        entity = entity_get(g_dbus_proxy_get_path(proxy));
+        entity->proxy = proxy;
+        entity->kind = !strcmp(interface, "org.bluez.Adapter1") ? KIND_ADAPTER : KIND_DEVICE;
+        if (events.all_devices || entity->kind == KIND_ADAPTER || entity_paired(entity))
+            entity_print(entity, "added");
+    } else if (!strcmp(interface, "org.bluez.Battery1")) {
+        entity = entity_get(g_dbus_proxy_get_path(proxy));
+        entity->battery = proxy;
+        entity_touch(entity);
+    }
+}
+
+internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
+    const char *interface = g_dbus_proxy_get_interface(proxy);
+    Entity *entity = g_hash_table_lookup(events.entities, g_dbus_proxy_get_path(proxy));
+
+    if (entity == NULL)
+        return;
+    if (!strcmp(interface, "org.bluez.Battery1")) {
+        entity->battery = NULL;
+        entity_touch(entity);
+    } else if (entity->proxy == proxy) {
+        if (events.all_devices || entity->kind == KIND_ADAPTER || entity->last)
+            entity_print(entity, "removed");
+        g_hash_table_remove(events.entities, entity->path);
+    }
+}
+
+internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageIter *iter, void *user_data) {
+    Entity *entity = g_hash_table_lookup(events.entities, g_dbus_proxy_get_path(proxy));
+
+    if (entity == NULL)
+        return;
+    for (u32 i = 0; i < G_N_ELEMENTS(watched_properties); i++) {
+        if (!strcmp(name, watched_properties[i])) {
+            entity_touch(entity);
+            return;
+        }
+    }
+}
+
+/** SETUP **/
+
+internal b32 parse_fields(const char *list) {
+    char **names = g_strsplit(list, ",", -1);
+    b32 ok = true;
+
+    events.fields = 0;
+    for (char **name = names; *name; name++) {
+        u32 i = 0;
+        for (; i < G_N_ELEMENTS(field_names); i++) {
+            if (!strcmp(*name, field_names[i]))
+                break;
+        }
+        if (i == G_N_ELEMENTS(field_names)) {
+            fprintf(stderr, "unknown field: %s\n", *name);
+            ok = false;
+        }
+        events.fields |= 1 << i;
+    }
+    g_strfreev(names);
+    return ok;
+}
+
+internal gboolean quit(gpointer user_data) {
+    g_main_loop_quit(events.loop);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (g_str_has_prefix(argv[i], "--fields=")) {
+            if (!parse_fields(argv[i] + strlen("--fields=")))
+                return 2;
+        } else if (g_str_has_prefix(argv[i], "--debounce=")) {
+            events.debounce_ms = strtoul(argv[i] + strlen("--debounce="), NULL, 10);
+        } else if (!strcmp(argv[i], "--all")) {
+            events.all_devices = true;
+        } else {
+            fprintf(stderr, "usage: %s [--fields=a,b,...] [--debounce=MS] [--all]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    DBusConnection *dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
+    if (dbus_conn == NULL) {
+        fprintf(stderr, "unable to connect to the system bus\n");
+        return 1;
+    }
+
+    events.loop = g_main_loop_new(NULL, false);
+    events.entities = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, entity_free);
+
+    GDBusClient *client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
+    g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed, property_changed, NULL);
+
+    g_unix_signal_add(SIGINT, quit, NULL);
+    g_unix_signal_add(SIGTERM, quit, NULL);
+    g_main_loop_run(events.loop);
+
+    g_dbus_client_unref(client);
+    dbus_connection_unref(dbus_conn);
+    g_hash_table_destroy(events.entities);
+    g_main_loop_unref(events.loop);
+    return 0;
+}
@@ -0,0 +1,366 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// rofi-bluetooth-replay feeds a recording made with -bluetooth-record or
+// rofi-bluetoothd --record back through the gdbus client, to benchmark and
+// profile against captured sessions:
+//
+//   rofi-bluetooth-replay [--speed=F | --max] RECORDING
+//
+// A thread plays BlueZ (and the bus daemon) on a peer-to-peer connection:
+// it answers GetNameOwner, AddMatch and GetManagedObjects, the last with the
+// recorded reply, then sends the recorded signals at their recorded pace,
+// scaled by --speed, or back to back with --max. The client side goes through
+// the normal watch and dispatch path, so handlers see what they saw live.
+
+#define G_LOG_DOMAIN "BluetoothReplay"
+
+#include <glib.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+#include "record.h"
+
+#define REPLAY_OWNER ":1.0"
+#define REPLAY_INTERFACE "org.rofi.Bluetooth.Replay"
+#define REPLAY_IDLE_TIMEOUT_MS 100
+
+typedef struct {
+    i64 timestamp;
+    DBusMessage *message;
+} ReplayEntry;
+
+global_variable struct {
+    GArray *entries;
+    // the recorded GetManagedObjects reply, if any
+    DBusMessage *objects;
+    i64 objects_timestamp;
+    u32 num_signals;
+    f64 speed;
+    b32 max_speed;
+
+    DBusServer *server;
+    DBusWatch *server_watch;
+    DBusConnection *peer;
+
+    GMainLoop *loop;
+    i64 start;
+    i64 ready;
+    i64 end;
+    u32 received;
+    u32 proxies_added;
+    u32 proxies_removed;
+    u32 properties_changed;
+} replay = {.speed = 1.0};
+
+/** RECORDING **/
+
+internal b32 load_recording(const char *path) {
+    FILE *file = fopen(path, "rb");
+    ReplayEntry entry;
+
+    if (file == NULL || !recording_open(file)) {
+        fprintf(stderr, "%s: not a recording\n", path);
+        if (file)
+            fclose(file);
+        return false;
+    }
+
+    replay.entries = g_array_new(false, false, sizeof(ReplayEntry));
+    while (recording_next(file, &entry.timestamp, &entry.message)) {
+        int type = dbus_message_get_type(entry.message);
+        if (type == DBUS_MESSAGE_TYPE_METHOD_RETURN && replay.objects == NULL) {
+            replay.objects = entry.message;
+            replay.objects_timestamp = entry.timestamp;
+        } else if (type == DBUS_MESSAGE_TYPE_SIGNAL) {
+            g_array_append_val(replay.entries, entry);
+            replay.num_signals++;
+        } else {
+            dbus_message_unref(entry.message);
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+/** FAKE BLUEZ **/
+
+internal DBusMessage *objects_reply(DBusMessage *call) {
+    DBusMessage *reply;
+
+    if (replay.objects == NULL) {
+        DBusMessageIter iter, array;
+        reply = dbus_message_new_method_return(call);
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{oa{sa{sv}}}", &array);
+        dbus_message_iter_close_container(&iter, &array);
+        return reply;
+    }
+
+    // a recorded message is locked once sent, so every send gets a copy
+    reply = dbus_message_copy(replay.objects);
+    dbus_message_set_reply_serial(reply, dbus_message_get_serial(call));
+    dbus_message_set_destination(reply, NULL);
+    return reply;
+}
+
+// Returns true once GetManagedObjects has been answered and playback can start.
+internal b32 answer(DBusConnection *conn, DBusMessage *call) {
+    const char *interface = dbus_message_get_interface(call);
+    const char *member = dbus_message_get_member(call);
+    DBusMessage *reply;
+    b32 objects = false;
+
+    if (dbus_message_get_type(call) != DBUS_MESSAGE_TYPE_METHOD_CALL || dbus_message_get_no_reply(call))
+        return false;
+
+    if (!g_strcmp0(interface, DBUS_INTERFACE_DBUS) && !g_strcmp0(member, "GetNameOwner")) {
+        const char *owner = REPLAY_OWNER;
+        reply = dbus_message_new_method_return(call);
+        dbus_message_append_args(reply, DBUS_TYPE_STRING, &owner, DBUS_TYPE_INVALID);
+    } else if (!g_strcmp0(interface, DBUS_INTERFACE_DBUS)) {
+        reply = dbus_message_new_method_return(call);
+    } else if (!g_strcmp0(member, "GetManagedObjects")) {
+        reply = objects_reply(call);
+        objects = true;
+    } else if (!g_strcmp0(interface, DBUS_INTERFACE_PROPERTIES) && !g_strcmp0(member, "GetAll")) {
+        DBusMessageIter iter, dict;
+        reply = dbus_message_new_method_return(call);
+        dbus_message_iter_init_append(reply, &iter);
+        dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+        dbus_message_iter_close_container(&iter, &dict);
+    } else {
+        reply = dbus_message_new_error(call, DBUS_ERROR_NOT_SUPPORTED, "not part of the recording");
+    }
+
+    dbus_message_set_sender(reply, REPLAY_OWNER);
+    dbus_connection_send(conn, reply, NULL);
+    dbus_message_unref(reply);
+    return objects;
+}
+
+internal gpointer feeder(gpointer data) {
+    DBusConnection *conn = replay.peer;
+    DBusMessage *message;
+    b32 started = false, done = false;
+    i64 start = 0;
+    u32 next = 0;
+
+    for (;;) {
+        int timeout = REPLAY_IDLE_TIMEOUT_MS;
+
+        if (started && next < replay.entries->len) {
+            ReplayEntry *entry = &g_array_index(replay.entries, ReplayEntry, next);
+            i64 offset = MAX(0, entry->timestamp - replay.objects_timestamp);
+            i64 due = replay.max_speed ? start : start + (i64)(offset / replay.speed);
+            timeout = MAX(0, due - g_get_monotonic_time()) / 1000;
+        }
+
+        if (!dbus_connection_read_write(conn, timeout))
+            break;
+
+        while ((message = dbus_connection_pop_message(conn))) {
+            if (answer(conn, message) && !started) {
+                started = true;
+                start = g_get_monotonic_time();
+            }
+            dbus_message_unref(message);
+        }
+
+        if (!started)
+            continue;
+
+        i64 now = g_get_monotonic_time();
+        for (; next < replay.entries->len; next++) {
+            ReplayEntry *entry = &g_array_index(replay.entries, ReplayEntry, next);
+            i64 offset = MAX(0, entry->timestamp - replay.objects_timestamp);
+            if (!replay.max_speed && start + (i64)(offset / replay.speed) > now)
+                break;
+
+            DBusMessage *signal = dbus_message_copy(entry->message);
+            dbus_message_set_sender(signal, REPLAY_OWNER);
+            dbus_connection_send(conn, signal, NULL);
+            dbus_message_unref(signal);
+        }
+
+        if (next == replay.entries->len && !done) {
+            DBusMessage *signal = dbus_message_new_signal("/", REPLAY_INTERFACE, "Done");
+            dbus_message_set_sender(signal, REPLAY_OWNER);
+            dbus_connection_send(conn, signal, NULL);
+            dbus_message_unref(signal);
+            done = true;
+        }
+    }
+
+    dbus_connection_close(conn);
+    dbus_connection_unref(conn);
+    return NULL;
+}
+
+/** PEER SETUP **/
+
+internal dbus_bool_t server_add_watch(DBusWatch *watch, void *data) {
+    replay.server_watch = watch;
+    return true;
+}
+
+internal void server_remove_watch(DBusWatch *watch, void *data) {
+    if (replay.server_watch == watch)
+        replay.server_watch = NULL;
+}
+
+internal void server_new_connection(DBusServer *server, DBusConnection *conn, void *data) {
+    replay.peer = dbus_connection_ref(conn);
+}
+
+// The client connect()s before anyone accepts, so accepting here cannot
+// block; the handshake itself happens on the feeder thread.
+internal b32 accept_peer(void) {
+    while (replay.peer == NULL && replay.server_watch) {
+        struct pollfd pfd = {.fd = dbus_watch_get_unix_fd(replay.server_watch), .events = POLLIN};
+        if (poll(&pfd, 1, REPLAY_IDLE_TIMEOUT_MS * 10) <= 0)
+            return false;
+        dbus_watch_handle(replay.server_watch, DBUS_WATCH_READABLE);
+    }
+    return replay.peer != NULL;
+}
+
+/** CLIENT **/
+
+internal DBusHandlerResult replay_filter(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_SIGNAL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    if (dbus_message_is_signal(message, REPLAY_INTERFACE, "Done")) {
+        replay.end = g_get_monotonic_time();
+        g_main_loop_quit(replay.loop);
+    } else {
+        replay.received++;
+    }
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    replay.proxies_added++;
+}
+
+internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
+    replay.proxies_removed++;
+}
+
+internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageIter *iter, void *user_data) {
+    replay.properties_changed++;
+}
+
+internal void client_ready(GDBusClient *client, void *user_data) {
+    replay.ready = g_get_monotonic_time();
+}
+
+/** SETUP **/
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    DBusError err;
+
+    for (int i = 1; i < argc; i++) {
+        if (g_str_has_prefix(argv[i], "--speed=")) {
+            replay.speed = g_ascii_strtod(argv[i] + strlen("--speed="), NULL);
+        } else if (!strcmp(argv[i], "--max")) {
+            replay.max_speed = true;
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || replay.speed <= 0) {
+        fprintf(stderr, "usage: %s [--speed=F | --max] RECORDING\n", argv[0]);
+        return 2;
+    }
+    if (!load_recording(path))
+        return 1;
+
+    dbus_threads_init_default();
+    dbus_error_init(&err);
+
+    replay.server = dbus_server_listen("unix:tmpdir=/tmp", &err);
+    if (replay.server == NULL) {
+        fprintf(stderr, "unable to listen: %s\n", err.message);
+        dbus_error_free(&err);
+        return 1;
+    }
+    dbus_server_set_new_connection_function(replay.server, server_new_connection, NULL, NULL);
+    dbus_server_set_watch_functions(replay.server, server_add_watch, server_remove_watch, NULL, NULL, NULL);
+
+    char *address = dbus_server_get_address(replay.server);
+    DBusConnection *dbus_conn = g_dbus_setup_address(address, &err);
+    dbus_free(address);
+    if (dbus_conn == NULL || !accept_peer()) {
+        fprintf(stderr, "unable to connect to the replay peer: %s\n", err.message ? err.message : "timeout");
+        dbus_error_free(&err);
+        return 1;
+    }
+    GThread *thread = g_thread_new("feeder", feeder, NULL);
+
+    replay.loop = g_main_loop_new(NULL, false);
+    dbus_connection_add_filter(dbus_conn, replay_filter, NULL, NULL);
+
+    replay.start = g_get_monotonic_time();
+    GDBusClient *client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
+    g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed, property_changed, NULL);
+    g_dbus_client_set_ready_watch(client, client_ready, NULL);
+    g_main_loop_run(replay.loop);
+
+    f64 total_ms = (replay.end - replay.start) / 1e3;
+    printf("objects ready after %.2fms\n", (replay.ready - replay.start) / 1e3);
+    printf("replayed %u signals in %.2fms (%.0f signals/s)\n", replay.received, total_ms,
+           total_ms > 0 ? replay.received / (total_ms / 1e3) : 0.0);
+    printf("proxies +%u -%u, %u property changes\n", replay.proxies_added, replay.proxies_removed,
+           replay.properties_changed);
+
+    g_dbus_client_unref(client);
+    dbus_connection_remove_filter(dbus_conn, replay_filter, NULL);
+    dbus_connection_close(dbus_conn);
+    dbus_connection_unref(dbus_conn);
+    g_thread_join(thread);
+
+    dbus_server_disconnect(replay.server);
+    dbus_server_unref(replay.server);
+    for (u32 i = 0; i < replay.entries->len; i++)
+        dbus_message_unref(g_array_index(replay.entries, ReplayEntry, i).message);
+    g_array_free(replay.entries, true);
+    if (replay.objects)
+        dbus_message_unref(replay.objects);
+    g_main_loop_unref(replay.loop);
+    return 0;
+}
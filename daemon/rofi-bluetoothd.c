@@ -0,0 +1,510 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// rofi-bluetoothd keeps a GDBusClient on org.bluez alive so the device model
+// is already warm when rofi opens the plugin. Clients connecting to the Unix
+// socket get one SNAPSHOT_FRAME_FULL and then a stream of upsert/remove
+// frames; see include/snapshot.h for the format. Adapter and paired-device
+// state is also published to shared memory for pollers (include/shm.h).
+//
+// usage: rofi-bluetoothd [--record=FILE] [SOCKET]
+// --record captures the BlueZ traffic for rofi-bluetooth-replay.
+// SIGUSR1 logs live memory per subsystem (include/memstat.h).
+
+#define _GNU_SOURCE
+#define G_LOG_DOMAIN "BluetoothDaemon"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+#include "memstat.h"
+#include "record.h"
+#include "shm.h"
+#include "snapshot.h"
+
+// a subscriber that can't keep up with the change stream is dropped
+#define SUBSCRIBER_MAX_PENDING (1 << 20)
+
+typedef struct {
+    int fd;
+    GIOChannel *channel;
+    guint read_watch;
+    guint write_watch;
+    GByteArray *pending;
+} Subscriber;
+
+global_variable struct {
+    GMainLoop *loop;
+    DBusConnection *dbus_conn;
+    GDBusClient *client;
+    // object path -> GDBusProxy for every Adapter1 and Device1
+    GHashTable *objects;
+    GList *subscribers;
+    char *socket_path;
+    int listen_fd;
+    ShmSnapshot *shm;
+    char *shm_name;
+    guint shm_publish;
+    Recorder *recorder;
+} daemon_state;
+
+/** RECORDS **/
+
+inline internal void get_property(GDBusProxy *proxy, const char *name, void *data) {
+    DBusMessageIter iter;
+    if (g_dbus_proxy_get_property(proxy, name, &iter) == false) return;
+    dbus_message_iter_get_basic(&iter, data);
+}
+
+internal u8 get_flag(GDBusProxy *proxy, const char *name, u8 flag) {
+    dbus_bool_t value = false;
+    get_property(proxy, name, &value);
+    return value ? flag : 0;
+}
+
+internal void record_from_proxy(GDBusProxy *proxy, SnapshotRecord *record) {
+    DBusMessageIter iter;
+
+    memset(record, 0, sizeof(*record));
+    record->path = g_dbus_proxy_get_path(proxy);
+
+    if (!strcmp(g_dbus_proxy_get_interface(proxy), "org.bluez.Adapter1")) {
+        record->kind = SNAPSHOT_KIND_ADAPTER;
+        record->flags = get_flag(proxy, "Powered", SNAPSHOT_FLAG_POWERED) |
+                        get_flag(proxy, "Discoverable", SNAPSHOT_FLAG_DISCOVERABLE) |
+                        get_flag(proxy, "Discovering", SNAPSHOT_FLAG_DISCOVERING);
+        get_property(proxy, "Address", &record->address);
+        get_property(proxy, "Alias", &record->name);
+        return;
+    }
+
+    record->kind = SNAPSHOT_KIND_DEVICE;
+    record->flags = get_flag(proxy, "Connected", SNAPSHOT_FLAG_CONNECTED) |
+                    get_flag(proxy, "Paired", SNAPSHOT_FLAG_PAIRED) | get_flag(proxy, "Trusted", SNAPSHOT_FLAG_TRUSTED);
+    if (g_dbus_proxy_get_property(proxy, "RSSI", &iter)) {
+        dbus_int16_t rssi;
+        dbus_message_iter_get_basic(&iter, &rssi);
+        record->rssi = rssi;
+        record->flags |= SNAPSHOT_FLAG_HAS_RSSI;
+    }
+    get_property(proxy, "Adapter", &record->adapter);
+    get_property(proxy, "Address", &record->address);
+    get_property(proxy, "Alias", &record->name);
+    get_property(proxy, "Icon", &record->icon);
+}
+
+/** SUBSCRIBERS **/
+
+internal void subscriber_free(Subscriber *sub) {
+    daemon_state.subscribers = g_list_remove(daemon_state.subscribers, sub);
+    if (sub->read_watch)
+        g_source_remove(sub->read_watch);
+    if (sub->write_watch)
+        g_source_remove(sub->write_watch);
+    g_io_channel_unref(sub->channel);
+    close(sub->fd);
+    g_byte_array_free(sub->pending, true);
+    g_free(sub);
+}
+
+internal gboolean subscriber_flush(GIOChannel *channel, GIOCondition cond, gpointer user_data);
+
+// Writes what the socket takes now and queues the rest, so one stalled
+// subscriber never blocks the D-Bus side of the daemon.
+internal b32 subscriber_send(Subscriber *sub, const u8 *data, u32 size) {
+    if (sub->pending->len == 0) {
+        ssize_t n = send(sub->fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return false;
+        if (n > 0) {
+            data += n;
+            size -= n;
+        }
+    }
+    if (size == 0)
+        return true;
+    if (sub->pending->len + size > SUBSCRIBER_MAX_PENDING)
+        return false;
+
+    g_byte_array_append(sub->pending, data, size);
+    if (!sub->write_watch)
+        sub->write_watch = g_io_add_watch(sub->channel, G_IO_OUT, subscriber_flush, sub);
+    return true;
+}
+
+internal gboolean subscriber_flush(GIOChannel *channel, GIOCondition cond, gpointer user_data) {
+    Subscriber *sub = user_data;
+    ssize_t n = send(sub->fd, sub->pending->data, sub->pending->len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        sub->write_watch = 0;
+        subscriber_free(sub);
+        return G_SOURCE_REMOVE;
+    }
+    if (n > 0)
+        g_byte_array_remove_range(sub->pending, 0, n);
+    if (sub->pending->len)
+        return G_SOURCE_CONTINUE;
+    sub->write_watch = 0;
+    return G_SOURCE_REMOVE;
+}
+
+// Subscribers never send anything; readable means they hung up.
+internal gboolean subscriber_readable(GIOChannel *channel, GIOCondition cond, gpointer user_data) {
+    Subscriber *sub = user_data;
+    u8 buf[64];
+
+    if (!(cond & (G_IO_HUP | G_IO_ERR)) && read(sub->fd, buf, sizeof(buf)) > 0)
+        return G_SOURCE_CONTINUE;
+    sub->read_watch = 0;
+    subscriber_free(sub);
+    return G_SOURCE_REMOVE;
+}
+
+internal void broadcast(GByteArray *frame) {
+    GList *l = daemon_state.subscribers;
+    while (l) {
+        Subscriber *sub = l->data;
+        l = l->next;
+        if (!subscriber_send(sub, frame->data, frame->len))
+            subscriber_free(sub);
+    }
+}
+
+internal void broadcast_record(u16 type, const SnapshotRecord *record) {
+    if (daemon_state.subscribers == NULL)
+        return;
+
+    GByteArray *frame = g_byte_array_new();
+    u32 start = snapshot_frame_begin(frame, type);
+    snapshot_append_record(frame, record);
+    snapshot_frame_end(frame, start);
+    broadcast(frame);
+    g_byte_array_free(frame, true);
+}
+
+internal void send_snapshot(Subscriber *sub) {
+    GByteArray *frame = g_byte_array_new();
+    GHashTableIter iter;
+    GDBusProxy *proxy;
+    SnapshotRecord record;
+
+    u32 start = snapshot_frame_begin(frame, SNAPSHOT_FRAME_FULL);
+    snapshot_append_u32(frame, g_hash_table_size(daemon_state.objects));
+    g_hash_table_iter_init(&iter, daemon_state.objects);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&proxy)) {
+        record_from_proxy(proxy, &record);
+        snapshot_append_record(frame, &record);
+    }
+    snapshot_frame_end(frame, start);
+
+    if (!subscriber_send(sub, frame->data, frame->len))
+        subscriber_free(sub);
+    g_byte_array_free(frame, true);
+}
+
+internal gboolean accept_subscriber(GIOChannel *channel, GIOCondition cond, gpointer user_data) {
+    int fd = accept4(daemon_state.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return G_SOURCE_CONTINUE;
+
+    Subscriber *sub = g_malloc0(sizeof(Subscriber));
+    sub->fd = fd;
+    sub->channel = g_io_channel_unix_new(fd);
+    sub->pending = g_byte_array_new();
+    sub->read_watch = g_io_add_watch(sub->channel, G_IO_IN | G_IO_HUP | G_IO_ERR, subscriber_readable, sub);
+    daemon_state.subscribers = g_list_prepend(daemon_state.subscribers, sub);
+
+    send_snapshot(sub);
+    return G_SOURCE_CONTINUE;
+}
+
+/** SHARED MEMORY **/
+
+internal void shm_copy_record(ShmRecord *out, const SnapshotRecord *record) {
+    memset(out, 0, sizeof(*out));
+    g_strlcpy(out->path, record->path, sizeof(out->path));
+    if (record->address)
+        g_strlcpy(out->address, record->address, sizeof(out->address));
+    if (record->name)
+        g_strlcpy(out->name, record->name, sizeof(out->name));
+    out->flags = ((record->flags & SNAPSHOT_FLAG_CONNECTED) ? SHM_FLAG_CONNECTED : 0) |
+                 ((record->flags & SNAPSHOT_FLAG_PAIRED) ? SHM_FLAG_PAIRED : 0) |
+                 ((record->flags & SNAPSHOT_FLAG_TRUSTED) ? SHM_FLAG_TRUSTED : 0) |
+                 ((record->flags & SNAPSHOT_FLAG_POWERED) ? SHM_FLAG_POWERED : 0) |
+                 ((record->flags & SNAPSHOT_FLAG_DISCOVERABLE) ? SHM_FLAG_DISCOVERABLE : 0) |
+                 ((record->flags & SNAPSHOT_FLAG_DISCOVERING) ? SHM_FLAG_DISCOVERING : 0);
+    out->adapter = SHM_MAX_ADAPTERS;
+}
+
+// Rewrites the whole segment inside one write section; called from idle so
+// a burst of property changes costs a single publish.
+internal gboolean shm_publish(gpointer user_data) {
+    ShmSnapshot *shm = daemon_state.shm;
+    GHashTableIter iter;
+    GDBusProxy *proxy;
+    SnapshotRecord record;
+    const char *adapter_paths[SHM_MAX_ADAPTERS];
+
+    daemon_state.shm_publish = 0;
+    shm_snapshot_write_begin(shm);
+    shm->num_adapters = 0;
+    shm->num_devices = 0;
+
+    g_hash_table_iter_init(&iter, daemon_state.objects);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&proxy)) {
+        record_from_proxy(proxy, &record);
+        if (record.kind != SNAPSHOT_KIND_ADAPTER || shm->num_adapters == SHM_MAX_ADAPTERS)
+            continue;
+        adapter_paths[shm->num_adapters] = record.path;
+        shm_copy_record(&shm->adapters[shm->num_adapters++], &record);
+    }
+
+    g_hash_table_iter_init(&iter, daemon_state.objects);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&proxy)) {
+        record_from_proxy(proxy, &record);
+        if (record.kind != SNAPSHOT_KIND_DEVICE || !(record.flags & SNAPSHOT_FLAG_PAIRED))
+            continue;
+        if (shm->num_devices == SHM_MAX_DEVICES)
+            break;
+        ShmRecord *out = &shm->devices[shm->num_devices++];
+        shm_copy_record(out, &record);
+        for (u32 a = 0; a < shm->num_adapters; a++) {
+            if (record.adapter && !strcmp(adapter_paths[a], record.adapter))
+                out->adapter = a;
+        }
+    }
+
+    shm_snapshot_write_end(shm);
+    return G_SOURCE_REMOVE;
+}
+
+internal void shm_changed(void) {
+    if (daemon_state.shm && !daemon_state.shm_publish)
+        daemon_state.shm_publish = g_idle_add(shm_publish, NULL);
+}
+
+// The segment lists paired devices, so only the owning user may read it
+// (a segment left behind by an older daemon is tightened as well); failing
+// to create it only disables publishing.
+internal void shm_setup(void) {
+    daemon_state.shm_name = shm_snapshot_name();
+    int fd = shm_open(daemon_state.shm_name, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        g_warning("shm_open %s: %s", daemon_state.shm_name, strerror(errno));
+        return;
+    }
+    if (fchmod(fd, 0600) == 0 && ftruncate(fd, sizeof(ShmSnapshot)) == 0) {
+        void *map = mmap(NULL, sizeof(ShmSnapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+            daemon_state.shm = map;
+    }
+    close(fd);
+    if (daemon_state.shm == NULL) {
+        shm_unlink(daemon_state.shm_name);
+        return;
+    }
+
+    shm_snapshot_write_begin(daemon_state.shm);
+    daemon_state.shm->magic = SHM_MAGIC;
+    daemon_state.shm->version = SHM_VERSION;
+    daemon_state.shm->num_adapters = 0;
+    daemon_state.shm->num_devices = 0;
+    shm_snapshot_write_end(daemon_state.shm);
+}
+
+internal void shm_teardown(void) {
+    if (daemon_state.shm_publish)
+        g_source_remove(daemon_state.shm_publish);
+    if (daemon_state.shm) {
+        munmap(daemon_state.shm, sizeof(ShmSnapshot));
+        shm_unlink(daemon_state.shm_name);
+    }
+    g_free(daemon_state.shm_name);
+}
+
+/** BLUEZ **/
+
+internal b32 tracked_interface(GDBusProxy *proxy) {
+    const char *interface = g_dbus_proxy_get_interface(proxy);
+    return !strcmp(interface, "org.bluez.Device1") || !strcmp(interface, "org.bluez.Adapter1");
+}
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    SnapshotRecord record;
+
+    if (!tracked_interface(proxy))
+        return;
+    g_hash_table_insert(daemon_state.objects, (gpointer)g_dbus_proxy_get_path(proxy), proxy);
+    record_from_proxy(proxy, &record);
+    broadcast_record(SNAPSHOT_FRAME_UPSERT, &record);
+    shm_changed();
+}
+
+internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
+    SnapshotRecord record = {0};
+
+    if (!tracked_interface(proxy))
+        return;
+    g_hash_table_remove(daemon_state.objects, g_dbus_proxy_get_path(proxy));
+    record.kind = !strcmp(g_dbus_proxy_get_interface(proxy), "org.bluez.Adapter1") ? SNAPSHOT_KIND_ADAPTER
+                                                                                    : SNAPSHOT_KIND_DEVICE;
+    record.path = g_dbus_proxy_get_path(proxy);
+    broadcast_record(SNAPSHOT_FRAME_REMOVE, &record);
+    shm_changed();
+}
+
+internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageIter *iter, void *user_data) {
+    SnapshotRecord record;
+
+    if (!tracked_interface(proxy))
+        return;
+    record_from_proxy(proxy, &record);
+    broadcast_record(SNAPSHOT_FRAME_UPSERT, &record);
+
+    // advertisement noise doesn't change anything the segment holds
+    if (strcmp(name, "RSSI") && strcmp(name, "TxPower") && strcmp(name, "ManufacturerData") &&
+        strcmp(name, "ServiceData"))
+        shm_changed();
+}
+
+/** SETUP **/
+
+// A socket file that still accepts connections belongs to a running daemon;
+// one that refuses them was left behind by a daemon that died.
+internal b32 socket_in_use(const struct sockaddr_un *addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    b32 in_use = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0;
+    close(fd);
+    return in_use;
+}
+
+internal b32 listen_socket(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        g_warning("socket path too long: %s", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    if (socket_in_use(&addr)) {
+        g_warning("another daemon is already listening on %s", path);
+        return false;
+    }
+
+    daemon_state.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (daemon_state.listen_fd < 0)
+        return false;
+
+    unlink(path);
+    // the device list is only for this user, from the moment the file exists
+    mode_t mask = umask(0077);
+    int bound = bind(daemon_state.listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (bound < 0 || listen(daemon_state.listen_fd, 8) < 0) {
+        g_warning("failed to listen on %s: %s", path, strerror(errno));
+        close(daemon_state.listen_fd);
+        return false;
+    }
+
+    GIOChannel *channel = g_io_channel_unix_new(daemon_state.listen_fd);
+    g_io_add_watch(channel, G_IO_IN, accept_subscriber, NULL);
+    g_io_channel_unref(channel);
+    return true;
+}
+
+internal gboolean quit(gpointer user_data) {
+    g_main_loop_quit(daemon_state.loop);
+    return G_SOURCE_REMOVE;
+}
+
+internal gboolean dump_memstat(gpointer user_data) {
+    memstat_dump(G_LOG_LEVEL_MESSAGE);
+    return G_SOURCE_CONTINUE;
+}
+
+int main(int argc, char **argv) {
+    int arg = 1;
+    if (arg < argc && g_str_has_prefix(argv[arg], "--record=")) {
+        daemon_state.recorder = recorder_open(argv[arg] + strlen("--record="));
+        if (daemon_state.recorder == NULL)
+            return 1;
+        arg++;
+    }
+    daemon_state.socket_path = arg < argc ? g_strdup(argv[arg]) : snapshot_socket_path();
+    daemon_state.loop = g_main_loop_new(NULL, false);
+    daemon_state.objects = g_hash_table_new(g_str_hash, g_str_equal);
+
+    daemon_state.dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
+    if (daemon_state.dbus_conn == NULL) {
+        g_warning("unable to connect to the system bus");
+        return 1;
+    }
+    if (!listen_socket(daemon_state.socket_path))
+        return 1;
+    shm_setup();
+
+    daemon_state.client = g_dbus_client_new(daemon_state.dbus_conn, "org.bluez", "/org/bluez");
+    g_dbus_client_set_proxy_handlers(daemon_state.client, proxy_added, proxy_removed, property_changed, NULL);
+    if (daemon_state.recorder)
+        g_dbus_client_set_record_watch(daemon_state.client, recorder_message, daemon_state.recorder);
+
+    g_unix_signal_add(SIGINT, quit, NULL);
+    g_unix_signal_add(SIGTERM, quit, NULL);
+    g_unix_signal_add(SIGUSR1, dump_memstat, NULL);
+    g_main_loop_run(daemon_state.loop);
+
+    while (daemon_state.subscribers)
+        subscriber_free(daemon_state.subscribers->data);
+    close(daemon_state.listen_fd);
+    unlink(daemon_state.socket_path);
+    shm_teardown();
+
+    g_dbus_client_set_record_watch(daemon_state.client, NULL, NULL);
+    recorder_close(daemon_state.recorder);
+    g_dbus_client_unref(daemon_state.client);
+    dbus_connection_unref(daemon_state.dbus_conn);
+    g_hash_table_destroy(daemon_state.objects);
+    g_main_loop_unref(daemon_state.loop);
+    g_free(daemon_state.socket_path);
+    return 0;
+}
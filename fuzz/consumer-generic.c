@@ -0,0 +1,85 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// fuzz-client's consumer: reads back every property the way a client of
+// the library would, without any plugin state in the way.
+
+#include <string.h>
+
+#include "fuzz.h"
+
+global_variable const char *property_names[] = {"Address", "Alias",   "Icon",    "Connected", "Paired",
+                                                "Trusted", "RSSI",    "Adapter", "Powered",   "Percentage"};
+
+internal void read_value(DBusMessageIter *iter) {
+    DBusMessageIter sub;
+    DBusBasicValue value;
+    int type = dbus_message_iter_get_arg_type(iter);
+
+    if (dbus_type_is_basic(type)) {
+        dbus_message_iter_get_basic(iter, &value);
+        if (type == DBUS_TYPE_STRING || type == DBUS_TYPE_OBJECT_PATH || type == DBUS_TYPE_SIGNATURE)
+            (void)strlen(value.str);
+        return;
+    }
+    if (!dbus_type_is_container(type))
+        return;
+
+    dbus_message_iter_recurse(iter, &sub);
+    while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+        read_value(&sub);
+        dbus_message_iter_next(&sub);
+    }
+}
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    DBusMessageIter iter;
+
+    (void)g_dbus_proxy_get_path(proxy);
+    (void)g_dbus_proxy_get_interface(proxy);
+    for (u32 i = 0; i < G_N_ELEMENTS(property_names); i++) {
+        if (g_dbus_proxy_get_property(proxy, property_names[i], &iter))
+            read_value(&iter);
+    }
+}
+
+internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
+    (void)g_dbus_proxy_get_path(proxy);
+}
+
+internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageIter *iter, void *user_data) {
+    (void)strlen(name);
+    if (iter)
+        read_value(iter);
+}
+
+internal void generic_setup(DBusConnection *conn, GDBusClient *client) {
+    g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed, property_changed, NULL);
+}
+
+internal void generic_teardown(void) {}
+
+const FuzzConsumer fuzz_consumer = {.setup = generic_setup, .teardown = generic_teardown};
@@ -0,0 +1,48 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// fuzz-plugin's consumer: the plugin itself, with its bus setup replaced by
+// the harness' connection; the rofi runtime comes from rofi-stubs.c.
+
+#include "../src/bluetooth.c"
+
+#include "fuzz.h"
+
+/** CONSUMER **/
+
+internal void plugin_setup(DBusConnection *conn, GDBusClient *client) {
+    BluetoothModePrivateData *pd = g_malloc0(sizeof(*pd));
+    mode_set_private_data(&mode, pd);
+
+    // bluetooth_mode_destroy drops both
+    pd->dbus_conn = dbus_connection_ref(conn);
+    pd->client = g_dbus_client_ref(client);
+    bluetooth_mode_init_state(&mode, pd);
+}
+
+internal void plugin_teardown(void) { bluetooth_mode_destroy(&mode); }
+
+const FuzzConsumer fuzz_consumer = {.setup = plugin_setup, .teardown = plugin_teardown};
@@ -0,0 +1,226 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// libFuzzer driver for the parsing in src/client.c, which it includes to
+// reach the static handlers. An input is a sequence of chunks
+//
+//   u8 kind, u8 arg, u16 size, then size bytes of message body
+//
+// where kind picks the handler and with it the body signature:
+//
+//   FUZZ_MANAGED_OBJECTS     a{oa{sa{sv}}}  parse_managed_objects()
+//   FUZZ_INTERFACES_ADDED    oa{sa{sv}}     interfaces_added()
+//   FUZZ_INTERFACES_REMOVED  oas            interfaces_removed()
+//   FUZZ_PROPERTIES_CHANGED  sa{sv}as       properties_changed() on proxy
+//                                           number arg
+//
+// Bodies go through libdbus' own validation (dbus_message_demarshal) just
+// as bytes from the bus would, so everything past that is fair game. Inputs
+// that take longer than FUZZ_MAX_INPUT_US or, under ASan, keep more than
+// FUZZ_MAX_RETAINED_PER_BYTE bytes alive per input byte abort, so libFuzzer
+// keeps them as crashes.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/client.c"
+
+#include "fuzz.h"
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#include <sanitizer/allocator_interface.h>
+#define FUZZ_ALLOCATOR_STATS 1
+#endif
+#endif
+
+#define FUZZ_MAX_INPUT_US (250 * 1000)
+#define FUZZ_MAX_RETAINED_PER_BYTE 256
+#define FUZZ_BASE_RETAINED (256 * 1024)
+
+enum FUZZ_CHUNK {
+    FUZZ_MANAGED_OBJECTS = 0,
+    FUZZ_INTERFACES_ADDED,
+    FUZZ_INTERFACES_REMOVED,
+    FUZZ_PROPERTIES_CHANGED,
+    FUZZ_CHUNK_NUM
+};
+
+global_variable const char *chunk_signatures[FUZZ_CHUNK_NUM] = {
+    "a{oa{sa{sv}}}", "oa{sa{sv}}", "oas", "sa{sv}as"
+};
+
+// Marshalled header of a message with each signature and an empty body
+global_variable GByteArray *chunk_headers[FUZZ_CHUNK_NUM];
+
+global_variable DBusConnection *fuzz_conn;
+
+internal void append_empty(DBusMessageIter *iter, const char *signature) {
+    DBusSignatureIter sig;
+    DBusMessageIter array;
+    const char *empty = "", *root = "/";
+
+    dbus_signature_iter_init(&sig, signature);
+    do {
+        switch (dbus_signature_iter_get_current_type(&sig)) {
+        case DBUS_TYPE_ARRAY: {
+            char *type = dbus_signature_iter_get_signature(&sig);
+            dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, type + 1, &array);
+            dbus_message_iter_close_container(iter, &array);
+            dbus_free(type);
+            break;
+        }
+        case DBUS_TYPE_OBJECT_PATH:
+            dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &root);
+            break;
+        default:
+            dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &empty);
+            break;
+        }
+    } while (dbus_signature_iter_next(&sig));
+}
+
+// The body starts at the first 8-byte boundary after the header fields,
+// whose length sits at offset 12.
+internal GByteArray *chunk_header_new(const char *signature) {
+    DBusMessage *msg;
+    DBusMessageIter iter;
+    GByteArray *header;
+    char *data;
+    int length;
+    u32 fields;
+
+    msg = dbus_message_new_signal("/org/bluez", "org.bluez.Fuzz", "Chunk");
+    dbus_message_iter_init_append(msg, &iter);
+    append_empty(&iter, signature);
+
+    if (!dbus_message_marshal(msg, &data, &length)) abort();
+
+    memcpy(&fields, data + 12, sizeof(fields));
+    length = (16 + fields + 7) & ~7;
+
+    header = g_byte_array_new();
+    g_byte_array_append(header, (const guint8 *)data, length);
+
+    dbus_free(data);
+    dbus_message_unref(msg);
+
+    return header;
+}
+
+internal DBusMessage *chunk_message(u8 kind, const u8 *body, u32 size) {
+    GByteArray *wire = g_byte_array_new();
+    DBusMessage *msg;
+    u32 length = size;
+
+    g_byte_array_append(wire, chunk_headers[kind]->data, chunk_headers[kind]->len);
+    memcpy(wire->data + 4, &length, sizeof(length));
+    g_byte_array_append(wire, body, size);
+
+    msg = dbus_message_demarshal((const char *)wire->data, wire->len, NULL);
+    g_byte_array_free(wire, true);
+
+    return msg;
+}
+
+int LLVMFuzzerInitialize(int *argc, char ***argv) {
+    unsigned int i;
+
+    fuzz_conn = disconnected_connection();
+
+    for (i = 0; i < FUZZ_CHUNK_NUM; i++)
+        chunk_headers[i] = chunk_header_new(chunk_signatures[i]);
+
+    return 0;
+}
+
+internal void run_chunk(GDBusClient *client, u8 kind, u8 arg, const u8 *body, u32 size) {
+    DBusMessage *msg = chunk_message(kind, body, size);
+    GDBusProxy *proxy;
+
+    if (msg == NULL) return;
+
+    switch (kind) {
+    case FUZZ_MANAGED_OBJECTS:
+        parse_managed_objects(client, msg);
+        break;
+    case FUZZ_INTERFACES_ADDED:
+        interfaces_added(fuzz_conn, msg, client);
+        break;
+    case FUZZ_INTERFACES_REMOVED:
+        interfaces_removed(fuzz_conn, msg, client);
+        break;
+    case FUZZ_PROPERTIES_CHANGED:
+        if (client->proxy_list == NULL) break;
+        proxy = g_list_nth_data(client->proxy_list, arg % g_list_length(client->proxy_list));
+        properties_changed(fuzz_conn, msg, proxy);
+        break;
+    }
+
+    dbus_message_unref(msg);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size) {
+    GDBusClient *client;
+    size_t offset = 0;
+    i64 start = g_get_monotonic_time();
+#ifdef FUZZ_ALLOCATOR_STATS
+    size_t baseline = __sanitizer_get_current_allocated_bytes();
+#endif
+
+    client = g_dbus_client_new(fuzz_conn, "org.bluez", "/org/bluez");
+    fuzz_consumer.setup(fuzz_conn, client);
+
+    while (offset + 4 <= size) {
+        u8 kind = data[offset] % FUZZ_CHUNK_NUM;
+        u8 arg = data[offset + 1];
+        u32 length = data[offset + 2] | (data[offset + 3] << 8);
+
+        offset += 4;
+        length = MIN(length, size - offset);
+        run_chunk(client, kind, arg, data + offset, length);
+        offset += length;
+    }
+
+#ifdef FUZZ_ALLOCATOR_STATS
+    size_t retained = __sanitizer_get_current_allocated_bytes() - baseline;
+    if (retained > FUZZ_BASE_RETAINED + size * FUZZ_MAX_RETAINED_PER_BYTE) {
+        fprintf(stderr, "%zu byte input retained %zu bytes\n", size, retained);
+        abort();
+    }
+#endif
+
+    g_dbus_client_unref(client);
+    fuzz_consumer.teardown();
+
+    if (g_get_monotonic_time() - start > FUZZ_MAX_INPUT_US) {
+        fprintf(stderr, "%zu byte input took %" G_GINT64_FORMAT "us\n", size, g_get_monotonic_time() - start);
+        abort();
+    }
+
+    return 0;
+}
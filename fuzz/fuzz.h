@@ -0,0 +1,22 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <gdbus.h>
+
+#include "bluetooth_internal.h"
+
+// Whoever receives the objects the fuzzed client builds: plain property
+// readers in fuzz-client, the plugin's own handlers in fuzz-plugin. setup
+// installs the proxy handlers and may take its own client reference;
+// teardown runs after the harness has dropped its reference.
+typedef struct {
+    void (*setup)(DBusConnection *conn, GDBusClient *client);
+    void (*teardown)(void);
+} FuzzConsumer;
+
+extern const FuzzConsumer fuzz_consumer;
+
+// from rofi-stubs.c
+DBusConnection *disconnected_connection(void);
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Just enough of the rofi runtime to link the plugin outside rofi, for the
+// fuzz and bench targets. Options are never set and reloads do nothing;
+// token matching follows rofi's own (every token must match, ^ inverts).
+// The fixtures every fuzz and bench target shares live here too.
+
+#include <dbus/dbus.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <rofi/mode.h>
+#include <rofi/mode-private.h>
+#include <rofi/helper.h>
+
+void *mode_get_private_data(const Mode *sw) { return sw->private_data; }
+
+void mode_set_private_data(Mode *sw, void *pd) { sw->private_data = pd; }
+
+int find_arg(const char *const key) { return -1; }
+
+int find_arg_str(const char *const key, char **val) { return false; }
+
+int find_arg_int(const char *const key, int *val) { return false; }
+
+int find_arg_uint(const char *const key, unsigned int *val) { return false; }
+
+int helper_token_match(rofi_int_matcher *const *tokens, const char *input) {
+    int match = true;
+    for (int i = 0; match && tokens && tokens[i]; i++) {
+        match = g_regex_match(tokens[i]->regex, input, 0, NULL);
+        match ^= tokens[i]->invert;
+    }
+    return match;
+}
+
+void rofi_view_reload(void) {}
+
+// A connection that was never attached to a bus: every send fails
+// immediately, so match rules and GetAll calls cost nothing.
+DBusConnection *disconnected_connection(void) {
+    DBusServer *server = dbus_server_listen("unix:tmpdir=/tmp", NULL);
+    if (server == NULL)
+        abort();
+
+    char *address = dbus_server_get_address(server);
+    DBusConnection *conn = dbus_connection_open_private(address, NULL);
+    dbus_free(address);
+    if (conn == NULL)
+        abort();
+
+    dbus_connection_set_exit_on_disconnect(conn, false);
+    dbus_connection_close(conn);
+    dbus_server_disconnect(server);
+    dbus_server_unref(server);
+    return conn;
+}
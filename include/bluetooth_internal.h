@@ -3,9 +3,15 @@
 
 #include <stdint.h>
 
+typedef uint8_t u8;
+typedef int16_t i16;
+typedef uint16_t u16;
+typedef int32_t i32;
 typedef uint32_t u32;
 typedef uint32_t b32;
 typedef uint64_t u64;
+typedef int64_t i64;
+typedef double f64;
 
 #define internal static
 #define global_variable static
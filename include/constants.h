@@ -21,4 +21,41 @@ global_variable const char *device_strings[3][2] = {
 };
 global_variable const char *true_false_array[2] = {"False", "True"};
 
+global_variable const char *operation_strings[2][4] = {
+    {"Connect", "connect", "Connecting", "Connected"},
+    {"Disconnect", "disconnect", "Disconnecting", "Disconnected"}
+};
+
+global_variable const char *pipeline_step_strings[3][2] = {
+    {"pair", "Paired"},
+    {"trust", "Trusted"},
+    {"connect", "Connected"}
+};
+
+#define REQUEST_POOL_SIZE 16
+
+#define RECONNECT_BASE_DELAY_MS 1000
+#define RECONNECT_MAX_DELAY_MS 60000
+#define RECONNECT_DEFAULT_MAX_ACTIVE 2
+#define RECONNECT_DEFAULT_MAX_ATTEMPTS 6
+
+// each RSSI sample moves the average 1/RSSI_SMOOTHING_DIVISOR of the way
+#define RSSI_SMOOTHING_DIVISOR 4
+#define RSSI_HYSTERESIS_DB 6
+#define RSSI_KEY_NONE INT32_MIN
+
+// range BlueZ accepts for the SetDiscoveryFilter RSSI threshold
+#define DISCOVERY_RSSI_MIN -127
+#define DISCOVERY_RSSI_MAX 20
+
+#define EVICTION_DEFAULT_MAX_UNPAIRED 128
+#define EVICTION_DEFAULT_STALE_SECONDS 300
+
+#define AGENT_PATH "/org/rofi/bluetooth/agent"
+#define AGENT_INTERFACE "org.bluez.Agent1"
+#define AGENT_MANAGER_INTERFACE "org.bluez.AgentManager1"
+#define AGENT_CAPABILITY "KeyboardDisplay"
+#define AGENT_ERROR_REJECTED "org.bluez.Error.Rejected"
+#define AGENT_ERROR_CANCELED "org.bluez.Error.Canceled"
+
 #endif
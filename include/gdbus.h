@@ -39,6 +39,8 @@ DBusConnection *g_dbus_setup_bus(DBusBusType type, const char *name,
 DBusConnection *g_dbus_setup_private(DBusBusType type, const char *name,
 							DBusError *error);
 
+DBusConnection *g_dbus_setup_address(const char *address, DBusError *error);
+
 gboolean g_dbus_request_name(DBusConnection *connection, const char *name,
 							DBusError *error);
 
@@ -223,6 +225,12 @@ gboolean g_dbus_unregister_interface(DBusConnection *connection,
 gboolean g_dbus_register_security(const GDBusSecurityTable *security);
 gboolean g_dbus_unregister_security(const GDBusSecurityTable *security);
 
+/*
+ * Cache builtin (polkit) authorization results per sender and action for
+ * ttl milliseconds. A ttl of 0, the default, only shares in-flight checks.
+ */
+void g_dbus_set_security_cache_ttl(unsigned int ttl);
+
 void g_dbus_pending_success(DBusConnection *connection,
 					GDBusPendingReply pending);
 void g_dbus_pending_error(DBusConnection *connection,
@@ -290,6 +298,16 @@ void g_dbus_pending_property_error_valist(GDBusPendingReply id,
 void g_dbus_pending_property_error(GDBusPendingReply id, const char *name,
 						const char *format, ...);
 
+typedef struct {
+	unsigned int outstanding;
+	gint64 oldest_age;		/* usec, oldest outstanding request */
+	guint64 completed;
+	gint64 total_latency;		/* usec, summed over completed */
+} GDBusPendingStats;
+
+void g_dbus_get_pending_security_stats(GDBusPendingStats *stats);
+void g_dbus_get_pending_property_stats(GDBusPendingStats *stats);
+
 /*
  * Note that when multiple properties for a given object path are changed
  * in the same mainloop iteration, they will be grouped with the last
@@ -388,6 +406,8 @@ gboolean g_dbus_client_set_disconnect_watch(GDBusClient *client,
 				GDBusWatchFunction function, void *user_data);
 gboolean g_dbus_client_set_signal_watch(GDBusClient *client,
 				GDBusMessageFunction function, void *user_data);
+gboolean g_dbus_client_set_record_watch(GDBusClient *client,
+				GDBusMessageFunction function, void *user_data);
 gboolean g_dbus_client_set_ready_watch(GDBusClient *client,
 				GDBusClientFunction ready, void *user_data);
 gboolean g_dbus_client_set_proxy_handlers(GDBusClient *client,
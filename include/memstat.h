@@ -0,0 +1,59 @@
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include <glib.h>
+
+// Live memory per subsystem, to see what the plugin costs on a host with
+// many devices. Bytes are what was requested from the allocator, without
+// its overhead, and leave out memory owned by libdbus such as the cached
+// property values inside prop entries. Counters are only touched from the
+// main loop. This header is shared with the gdbus helpers, so it sticks
+// to glib types.
+
+enum MEMSTAT_CATEGORY {
+    MEMSTAT_PROXY = 0,      // client.c: proxies with their path and interface
+    MEMSTAT_PROP_ENTRY,     // client.c: property cache entries
+    MEMSTAT_PENDING_CALL,   // client.c: per-call state waiting for a reply
+    MEMSTAT_WATCH,          // watch.c: filter_data and its match strings
+    MEMSTAT_WATCH_CALLBACK, // watch.c: filter callbacks and name lookups
+    MEMSTAT_OBJECT,         // object.c: exported object paths
+    MEMSTAT_INTERFACE,      // object.c: interfaces on exported paths
+    MEMSTAT_DEVICE,         // bluetooth.c: device table
+    MEMSTAT_ENTRY,          // bluetooth.c: entry table
+    MEMSTAT_STRING,         // bluetooth.c: allocated entry texts
+    MEMSTAT_NUM
+};
+
+typedef struct {
+    gint64 bytes;
+    gint64 objects;
+    gint64 peak_bytes;
+    guint64 allocations;
+} MemStat;
+
+extern MemStat memstat_table[MEMSTAT_NUM];
+
+// objects > 0 counts as that many allocations
+static inline void memstat_add(guint category, gint64 bytes, gint64 objects) {
+    MemStat *stat = &memstat_table[category];
+    stat->bytes += bytes;
+    stat->objects += objects;
+    if (objects > 0)
+        stat->allocations += objects;
+    if (stat->bytes > stat->peak_bytes)
+        stat->peak_bytes = stat->bytes;
+}
+
+// Counted counterparts of g_malloc0, g_free and g_strdup. The size
+// handed to memstat_free must match the one allocated.
+void *memstat_alloc0(guint category, gsize size);
+void memstat_free(guint category, void *ptr, gsize size);
+char *memstat_strdup(guint category, const char *string);
+void memstat_free_string(guint category, char *string);
+
+const char *memstat_category_name(guint category);
+void memstat_get(guint category, MemStat *stat);
+// one line per category at the given level, e.g. G_LOG_LEVEL_DEBUG
+void memstat_dump(GLogLevelFlags level);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// Static tracepoints (USDT) under the provider "rofi_bluetooth", for
+// bpftrace or perf on a running rofi or rofi-bluetoothd; see
+// trace/rofi-bluetooth.bt. They are compiled in when <sys/sdt.h> is found
+// (systemtap-sdt-dev) and cost a nop each until a tracer attaches. Their
+// arguments are evaluated either way, so only pass values that are already
+// at hand.
+//
+//   signal_begin  path, member          message_filter got a signal
+//   signal_end    member                ...and ran its watches
+//   prop_update   path, name, changed   add_property cached a value
+//   proxy_new     proxy, path, iface
+//   proxy_free    proxy, path
+//   method_call   data, path, method    data is NULL without a reply
+//   method_reply  data, is_error
+//   entries_begin state, devices        update_entries
+//   entries_end   state, entries
+//   view_reload                         before rofi_view_reload
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE(name) DTRACE_PROBE(rofi_bluetooth, name)
+#define PROBE1(name, a) DTRACE_PROBE1(rofi_bluetooth, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(rofi_bluetooth, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(rofi_bluetooth, name, a, b, c)
+#else
+#define PROBE(name) \
+    do {            \
+    } while (0)
+#define PROBE1(name, a) PROBE(name)
+#define PROBE2(name, a, b) PROBE(name)
+#define PROBE3(name, a, b, c) PROBE(name)
+#endif
+
+#endif
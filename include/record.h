@@ -0,0 +1,47 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <dbus/dbus.h>
+#include <glib.h>
+#include <stdio.h>
+
+#include "bluetooth_internal.h"
+
+// Captured BlueZ traffic, for replaying field sessions under a profiler.
+// A recording is a RecordHeader followed by entries: a RecordEntry and
+// `length` bytes of the message in D-Bus wire format (dbus_message_marshal),
+// in host byte order. Timestamps are microseconds since the recording
+// started.
+
+#define RECORD_MAGIC 0x52444252 // "RBDR"
+#define RECORD_VERSION 1
+#define RECORD_MAX_MESSAGE (1 << 27)
+
+typedef struct {
+    u32 magic;
+    u32 version;
+} RecordHeader;
+
+typedef struct {
+    i64 timestamp;
+    u32 length;
+    u32 reserved;
+} RecordEntry;
+
+typedef struct {
+    FILE *file;
+    i64 start;
+    u32 messages;
+    u64 bytes;
+} Recorder;
+
+Recorder *recorder_open(const char *path);
+void recorder_close(Recorder *recorder);
+// Matches GDBusMessageFunction so it can be handed to
+// g_dbus_client_set_record_watch directly.
+void recorder_message(DBusConnection *connection, DBusMessage *message, void *user_data);
+
+b32 recording_open(FILE *file);
+b32 recording_next(FILE *file, i64 *timestamp, DBusMessage **message);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "bluetooth_internal.h"
+
+// Adapter and paired-device state published by rofi-bluetoothd into a POSIX
+// shared memory segment (shm_snapshot_name()). Readers map it read-only and
+// copy it out with shm_snapshot_read, which retries while the daemon is
+// mid-write: sequence is odd during a write and bumped again when done, so
+// a copy taken between two equal even values is consistent. generation
+// counts completed writes, letting pollers skip unchanged state cheaply.
+
+#define SHM_MAGIC 0x4d484252 // "RBHM"
+#define SHM_VERSION 1
+#define SHM_MAX_ADAPTERS 4
+#define SHM_MAX_DEVICES 64
+#define SHM_PATH_SIZE 64
+#define SHM_ADDRESS_SIZE 18
+#define SHM_NAME_SIZE 64
+
+enum SHM_FLAG {
+    SHM_FLAG_CONNECTED = 1 << 0,
+    SHM_FLAG_PAIRED = 1 << 1,
+    SHM_FLAG_TRUSTED = 1 << 2,
+    SHM_FLAG_POWERED = 1 << 3,
+    SHM_FLAG_DISCOVERABLE = 1 << 4,
+    SHM_FLAG_DISCOVERING = 1 << 5
+};
+
+typedef struct {
+    char path[SHM_PATH_SIZE];
+    char address[SHM_ADDRESS_SIZE];
+    char name[SHM_NAME_SIZE];
+    u16 flags;
+    // index into adapters, or SHM_MAX_ADAPTERS if unknown; unused for adapters
+    u32 adapter;
+} ShmRecord;
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 sequence;
+    u32 num_adapters;
+    u32 num_devices;
+    u64 generation;
+    ShmRecord adapters[SHM_MAX_ADAPTERS];
+    ShmRecord devices[SHM_MAX_DEVICES];
+} ShmSnapshot;
+
+char *shm_snapshot_name(void);
+
+void shm_snapshot_write_begin(ShmSnapshot *shared);
+void shm_snapshot_write_end(ShmSnapshot *shared);
+b32 shm_snapshot_read(const ShmSnapshot *shared, ShmSnapshot *copy);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <glib.h>
+
+#include "bluetooth_internal.h"
+
+// Wire format between rofi-bluetoothd and its clients. Every message is a
+// frame: a SnapshotHeader followed by `length` bytes of payload, in host
+// byte order since both ends share a machine.
+//
+//   SNAPSHOT_FRAME_FULL    u32 record count, then that many records
+//   SNAPSHOT_FRAME_UPSERT  one record that was added or changed
+//   SNAPSHOT_FRAME_REMOVE  one record of which only kind and path are set
+//
+// A record is u8 kind, u8 flags, i16 rssi, then the strings path, adapter,
+// address, name and icon, each a u16 length (including the terminating
+// NUL) followed by the bytes. A length of 0 means the string is absent.
+
+#define SNAPSHOT_MAGIC 0x53544252 // "RBTS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_SOCKET_NAME "rofi-bluetooth.sock"
+#define SNAPSHOT_MAX_FRAME (1 << 24)
+// how long the plugin waits on the daemon before opening without it
+#define SNAPSHOT_READ_TIMEOUT_MS 50
+
+enum SNAPSHOT_FRAME { SNAPSHOT_FRAME_FULL = 1, SNAPSHOT_FRAME_UPSERT, SNAPSHOT_FRAME_REMOVE };
+
+enum SNAPSHOT_KIND { SNAPSHOT_KIND_ADAPTER = 1, SNAPSHOT_KIND_DEVICE };
+
+enum SNAPSHOT_FLAG {
+    SNAPSHOT_FLAG_CONNECTED = 1 << 0,
+    SNAPSHOT_FLAG_PAIRED = 1 << 1,
+    SNAPSHOT_FLAG_TRUSTED = 1 << 2,
+    SNAPSHOT_FLAG_HAS_RSSI = 1 << 3,
+    SNAPSHOT_FLAG_POWERED = 1 << 4,
+    SNAPSHOT_FLAG_DISCOVERABLE = 1 << 5,
+    SNAPSHOT_FLAG_DISCOVERING = 1 << 6
+};
+
+typedef struct {
+    u32 magic;
+    u16 version;
+    u16 type;
+    u32 length;
+} SnapshotHeader;
+
+// Decoded strings point into the frame buffer and live as long as it does.
+typedef struct {
+    u8 kind;
+    u8 flags;
+    i16 rssi;
+    const char *path;
+    const char *adapter;
+    const char *address;
+    const char *name;
+    const char *icon;
+} SnapshotRecord;
+
+typedef struct {
+    const u8 *data;
+    u32 size;
+    u32 offset;
+} SnapshotReader;
+
+char *snapshot_socket_path(void);
+b32 snapshot_peer_is_self(int fd);
+
+u32 snapshot_frame_begin(GByteArray *out, u16 type);
+void snapshot_frame_end(GByteArray *out, u32 frame);
+void snapshot_append_u32(GByteArray *out, u32 value);
+void snapshot_append_record(GByteArray *out, const SnapshotRecord *record);
+
+b32 snapshot_header_valid(const SnapshotHeader *header);
+b32 snapshot_read_u32(SnapshotReader *reader, u32 *value);
+b32 snapshot_read_record(SnapshotReader *reader, SnapshotRecord *record);
+
+// deadline is a g_get_monotonic_time() value, or 0 to wait indefinitely
+b32 snapshot_read_frame(int fd, SnapshotHeader *header, u8 **payload, i64 deadline);
+
+#endif
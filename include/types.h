@@ -3,8 +3,17 @@
 
 #include "bluetooth_internal.h"
 #include "gdbus.h"
+#include "record.h"
 
-enum STATE { LIST = 0, DEVICE, PAIR };
+enum STATE { LIST = 0, DEVICE, PAIR, AGENT };
+
+enum AGENT_REQUEST {
+    AGENT_REQUEST_NONE = 0,
+    AGENT_REQUEST_CONFIRMATION,
+    AGENT_REQUEST_AUTHORIZATION,
+    AGENT_REQUEST_PASSKEY,
+    AGENT_REQUEST_PIN_CODE
+};
 
 enum ENTRY {
     ENTRY_DEVICE = 1,
@@ -15,24 +24,47 @@ enum ENTRY {
     ENTRY_DEVICE_CONNECT = 1 << 6,
     ENTRY_MENU_PAIR = 1 << 7,
     ENTRY_MENU_LIST = 1 << 8,
-    ENTRY_ALLOCATED = 1 << 9
+    ENTRY_ALLOCATED = 1 << 9,
+    ENTRY_AGENT_ACCEPT = 1 << 10,
+    ENTRY_AGENT_REJECT = 1 << 11,
+    ENTRY_DEVICE_PAIR_CONNECT = 1 << 12,
+    ENTRY_CONNECT_AUDIO = 1 << 13,
+    ENTRY_DISCONNECT_ALL = 1 << 14,
+    ENTRY_ADAPTER = 1 << 15
 };
 
+enum OPERATION { OPERATION_CONNECT = 0, OPERATION_DISCONNECT, OPERATION_NUM };
+
+enum PIPELINE_STEP { PIPELINE_PAIR = 0, PIPELINE_TRUST, PIPELINE_CONNECT, PIPELINE_NUM_STEPS };
+
 typedef struct {
     GDBusProxy *remote_proxy;
+    const char *path;
+    char *name;
     b32 powered;
     b32 discoverable;
     b32 discovering;
 } Controller;
 
 typedef struct {
+    // NULL for a device only known from the daemon snapshot so far
     GDBusProxy *remote_proxy;
+    const char *path;
     char *address;
     char *name;
+    char *icon;
+    // object path of the Adapter1 the device was seen through
+    char *adapter;
     b32 connected;
     b32 paired;
     b32 trusted;
 
+    // RSSI smoothed in 1/16 dBm, and the coarser value the pair list is
+    // ordered by; rssi_key only follows rssi past RSSI_HYSTERESIS_DB
+    b32 has_rssi;
+    i32 rssi;
+    i32 rssi_key;
+    i64 last_seen;
 } Device;
 
 typedef struct {
@@ -46,25 +78,180 @@ typedef struct {
 } Entry;
 
 typedef struct {
+    DBusMessage *message;
+    u32 request;
+    u32 passkey;
+    char *device_name;
+    u32 return_state;
+} AgentRequest;
+
+typedef struct BluetoothModePrivateData BluetoothModePrivateData;
+
+// Pair -> Trust -> Connect for one device. Pair and Trust are issued
+// together, Connect once both are satisfied, either by their replies or
+// by the matching PropertiesChanged, whichever arrives first. Connected
+// only counts once Connect went out, since Pair raises it for the link.
+typedef struct {
+    BluetoothModePrivateData *pd;
+    GDBusProxy *proxy;
+    u32 outstanding;
+    u32 pending;
+    b32 connect_sent;
+    i64 start;
+    i64 step_start[PIPELINE_NUM_STEPS];
+    i64 step_time[PIPELINE_NUM_STEPS];
+} Pipeline;
+
+// Aggregate for a group of operations fired together, e.g. "connect all
+// audio devices"; reports once the last of them completes.
+typedef struct {
+    u32 op;
+    u32 outstanding;
+    u32 total;
+    u32 failed;
+    i64 start;
+} OperationBatch;
+
+// One in-flight Connect/Disconnect, keyed by device proxy in
+// BluetoothModePrivateData.operations.
+typedef struct {
+    BluetoothModePrivateData *pd;
+    GDBusProxy *proxy;
+    u32 op;
+    i64 start;
+    OperationBatch *batch;
+} Operation;
+
+#define RECONNECT_HISTOGRAM_BUCKETS 8
+
+// Background reconnect state for one trusted device that dropped. An entry
+// marked cancelled only records that the user disconnected on purpose.
+typedef struct {
+    BluetoothModePrivateData *pd;
+    GDBusProxy *proxy;
+    u32 attempt;
+    guint timer;
+    b32 waiting;
+    b32 in_flight;
+    b32 cancelled;
+    b32 done;
+    i64 dropped;
+} Reconnect;
+
+typedef struct {
+    b32 enabled;
+    u32 max_active;
+    u32 max_attempts;
+    u32 active;
+    GHashTable *devices;
+    GQueue waiting;
+    // reconnect latency from drop to Connected, bucket i < 2^i * 500ms
+    u32 histogram[RECONNECT_HISTOGRAM_BUCKETS];
+    u32 succeeded;
+    u32 given_up;
+} ReconnectScheduler;
+
+// Discovery filter pushed to the adapter with SetDiscoveryFilter, so BlueZ
+// drops unwanted advertisers before they ever reach us. transport, rssi and
+// uuids come from the command line; pattern follows the PAIR state input
+// when -bluetooth-scan-prefix asks for it.
+typedef struct {
+    char *transport;
+    b32 has_rssi;
+    i32 rssi;
+    char **uuids;
+    u32 num_uuids;
+    b32 prefix;
+    char *pattern;
+    b32 in_flight;
+    b32 dirty;
+} DiscoveryFilter;
+
+// Discovery started from the menu, bounded by -bluetooth-scan-timeout and
+// optionally duty cycled so the adapter isn't scanning continuously.
+typedef struct {
+    u32 max_duration_ms;
+    u32 on_ms;
+    u32 off_ms;
+    char *target;
+    guint timer;
+    b32 active;
+    b32 paused;
+    i64 start;
+    i64 first_result;
+    u32 devices_found;
+    u64 signals;
+} DiscoverySession;
+
+// Bounds how many transient unpaired devices are kept during long scans.
+typedef struct {
+    u32 max_unpaired;
+    u32 stale_seconds;
+    b32 remove;
+    guint timer;
+    u32 evicted;
+} EvictionPolicy;
+
+// Context for one outstanding Set/Pair/Remove/Scan call. Contexts are taken
+// from a static pool, and are linked into BluetoothModePrivateData.requests
+// while in flight so they can be detached if the mode goes away first.
+#define REQUEST_LABEL_SIZE 96
+
+typedef struct Request Request;
+struct Request {
+    BluetoothModePrivateData *pd;
+    Request *prev;
+    Request *next;
+    b32 pooled;
+    b32 flag;
+    i64 start;
+    i64 end;
+    char label[REQUEST_LABEL_SIZE];
+};
+
+struct BluetoothModePrivateData {
     u32 state;
 
     Entry *entries;
     u32 num_entries;
     u32 size_entries;
 
+    // every Adapter1 keyed by object path; controller is the selected one
+    GHashTable *controllers;
     Controller *controller;
 
     Device *devices;
     u32 num_devices;
     u32 num_paired_devices;
     u32 size_devices;
+
+    // unpaired device indices, strongest rssi_key first; PAIR state entries
+    // are laid out in this order
+    u32 *pair_order;
+    u32 num_pair_order;
+    u32 size_pair_order;
     u32 current_device;
 
     GDBusClient *client;
     DBusConnection *dbus_conn;
 
+    GDBusProxy *agent_manager;
+    b32 agent_registered;
+    AgentRequest agent;
+
     char *command_status;
 
-} BluetoothModePrivateData;
+    Pipeline *pipeline;
+    GHashTable *operations;
+    Request *requests;
+    // payload of the daemon snapshot, which unbound devices point into
+    u8 *snapshot;
+    ReconnectScheduler reconnect;
+    DiscoveryFilter filter;
+    DiscoverySession discovery;
+    EvictionPolicy eviction;
+    // -bluetooth-record FILE captures BlueZ traffic for rofi-bluetooth-replay
+    Recorder *recorder;
+};
 
 #endif
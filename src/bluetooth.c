@@ -31,6 +31,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <gdbus.h>
@@ -44,6 +46,9 @@
 
 #include "bluetooth_internal.h"
 #include "constants.h"
+#include "memstat.h"
+#include "probes.h"
+#include "snapshot.h"
 #include "types.h"
 
 G_MODULE_EXPORT Mode mode;
@@ -53,18 +58,13 @@ G_MODULE_EXPORT Mode mode;
 #define C_TF(i) true_false_array[(&pd->controller->powered)[i]]
 #define DS(i, val) device_strings[i][val]
 
-global_variable struct GenericCallbackData {
-    BluetoothModePrivateData *pd;
-    void *data;
-} generic_callback_data = {.pd = NULL, .data = NULL};
+extern void rofi_view_reload(void);
 
-internal void free_generic_callback_data(void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    g_free(data->data);
+inline internal void reload_view(void) {
+    PROBE(view_reload);
+    rofi_view_reload();
 }
 
-extern void rofi_view_reload(void);
-
 inline internal void get_property(GDBusProxy *proxy, const char *name, void *data) {
     DBusMessageIter iter;
     if (g_dbus_proxy_get_property(proxy, name, &iter) == false) return;
@@ -76,15 +76,59 @@ internal void debug_print_device(Device *device) {
             device->name, device->paired, device->trusted, device->connected);
 }
 
+// With more than one adapter, lists only show the selected controller's
+// devices; a device with no Adapter property is shown everywhere.
+internal b32 device_on_controller(BluetoothModePrivateData *pd, Device *dev) {
+    return pd->controller == NULL || dev->adapter == NULL || !strcmp(dev->adapter, pd->controller->path);
+}
+
+internal Controller *device_controller(BluetoothModePrivateData *pd, Device *dev) {
+    Controller *controller = dev->adapter ? g_hash_table_lookup(pd->controllers, dev->adapter) : NULL;
+    return controller ? controller : pd->controller;
+}
+
+internal Controller *find_controller(BluetoothModePrivateData *pd, GDBusProxy *proxy) {
+    return g_hash_table_lookup(pd->controllers, g_dbus_proxy_get_path(proxy));
+}
+
+// The controller after the selected one in path order, wrapping around.
+internal Controller *next_controller(BluetoothModePrivateData *pd) {
+    GHashTableIter iter;
+    Controller *controller, *first = NULL, *next = NULL;
+    const char *current = pd->controller ? pd->controller->path : "";
+
+    g_hash_table_iter_init(&iter, pd->controllers);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&controller)) {
+        if (first == NULL || strcmp(controller->path, first->path) < 0)
+            first = controller;
+        if (strcmp(controller->path, current) > 0 && (next == NULL || strcmp(controller->path, next->path) < 0))
+            next = controller;
+    }
+    return next ? next : first;
+}
+
 internal void debug_print_controller(Controller *controller) {
     g_debug("Controller {\n\tPowered: %d\n\tDiscoverable: %d\n\tDiscovering: %d\n}", controller->powered,
             controller->discoverable, controller->discovering);
 }
 
+// Texts of ENTRY_ALLOCATED entries are owned by the entry.
+inline internal void entry_free_text(Entry *entry) {
+    if (entry->flags & ENTRY_ALLOCATED) {
+        memstat_add(MEMSTAT_STRING, -(i64)(strlen(entry->text) + 1), -1);
+        g_free(entry->text);
+    }
+}
+
 inline internal void resize_entries_if_needed(BluetoothModePrivateData *pd, u32 new_num_entries) {
 
+    // every caller rebuilds the list from scratch, so the old rows go first
+    for (u32 i = 0; i < pd->num_entries; i++)
+        entry_free_text(&pd->entries[i]);
+    memstat_add(MEMSTAT_ENTRY, 0, (i64)new_num_entries - pd->num_entries);
     pd->num_entries = new_num_entries;
     if (pd->size_entries < pd->num_entries) {
+        memstat_add(MEMSTAT_ENTRY, sizeof(Entry) * (pd->num_entries - pd->size_entries), 0);
         pd->size_entries = pd->num_entries;
         pd->entries = g_realloc(pd->entries, sizeof(Entry) * pd->size_entries);
     }
@@ -94,116 +138,1416 @@ inline internal void set_entry(Entry *entry, char *text, u32 flags, u32 data) {
     entry->text = text;
     entry->flags = flags;
     entry->device = data;
+    if (flags & ENTRY_ALLOCATED)
+        memstat_add(MEMSTAT_STRING, strlen(text) + 1, 1);
+}
+
+// for rows updated in place
+inline internal void replace_entry_text(Entry *entry, char *text) {
+    entry_free_text(entry);
+    set_entry(entry, text, entry->flags, entry->device);
+}
+
+inline internal void grow_devices_if_needed(BluetoothModePrivateData *pd) {
+    if (pd->size_devices <= pd->num_devices) {
+        memstat_add(MEMSTAT_DEVICE, sizeof(Device) * pd->size_devices, 0);
+        pd->size_devices *= 2;
+        pd->devices = g_realloc(pd->devices, sizeof(Device) * pd->size_devices);
+    }
+}
+
+internal char *device_row_text(BluetoothModePrivateData *pd, Device *device) {
+    const char *status = TF(device->connected);
+    Operation *op = g_hash_table_lookup(pd->operations, device->remote_proxy);
+    if (op)
+        status = operation_strings[op->op][2];
+
+    u64 nb = strlen(device->name);
+    u64 nub = g_utf8_strlen(device->name, nb);
+    return g_strdup_printf("%-*s%-10s", (u32)(20 + nb - nub), device->name, status);
+}
+
+internal void update_device_row(BluetoothModePrivateData *pd, u32 dev_index) {
+    if (pd->state != LIST)
+        return;
+    for (u32 i = 0; i < pd->num_entries; i++) {
+        Entry *entry = &pd->entries[i];
+        if ((entry->flags & ~ENTRY_ALLOCATED) == ENTRY_DEVICE && entry->device == dev_index) {
+            replace_entry_text(entry, device_row_text(pd, &pd->devices[dev_index]));
+            break;
+        }
+    }
+}
+
+/** PAIR ORDER **/
+
+// First position whose key is weaker than key, so equal keys keep their
+// arrival order.
+internal u32 pair_order_position(BluetoothModePrivateData *pd, i32 key) {
+    u32 lo = 0, hi = pd->num_pair_order;
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (pd->devices[pd->pair_order[mid]].rssi_key >= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+internal u32 pair_order_find(BluetoothModePrivateData *pd, u32 dev_index) {
+    for (u32 i = 0; i < pd->num_pair_order; i++) {
+        if (pd->pair_order[i] == dev_index)
+            return i;
+    }
+    return pd->num_pair_order;
+}
+
+internal void pair_order_insert(BluetoothModePrivateData *pd, u32 dev_index) {
+    if (pd->size_pair_order <= pd->num_pair_order) {
+        pd->size_pair_order = pd->size_pair_order ? pd->size_pair_order * 2 : 8;
+        pd->pair_order = g_realloc(pd->pair_order, sizeof(u32) * pd->size_pair_order);
+    }
+    u32 pos = pair_order_position(pd, pd->devices[dev_index].rssi_key);
+    memmove(&pd->pair_order[pos + 1], &pd->pair_order[pos], sizeof(u32) * (pd->num_pair_order - pos));
+    pd->pair_order[pos] = dev_index;
+    pd->num_pair_order++;
+}
+
+internal void pair_order_remove(BluetoothModePrivateData *pd, u32 dev_index) {
+    u32 pos = pair_order_find(pd, dev_index);
+    if (pos == pd->num_pair_order)
+        return;
+    pd->num_pair_order--;
+    memmove(&pd->pair_order[pos], &pd->pair_order[pos + 1], sizeof(u32) * (pd->num_pair_order - pos));
+}
+
+// The device at old_index moved to new_index (unordered remove from devices).
+internal void pair_order_renumber(BluetoothModePrivateData *pd, u32 old_index, u32 new_index) {
+    u32 pos = pair_order_find(pd, old_index);
+    if (pos != pd->num_pair_order)
+        pd->pair_order[pos] = new_index;
+}
+
+// Feeds one RSSI sample (or its invalidation) into the device's average.
+// Returns true if the PAIR list order changed; the matching entry is moved
+// in place rather than rebuilding the list.
+internal b32 pair_order_update_rssi(BluetoothModePrivateData *pd, u32 dev_index, b32 has_sample, i32 sample) {
+    Device *dev = &pd->devices[dev_index];
+    i32 key;
+
+    if (!has_sample) {
+        dev->has_rssi = false;
+        key = RSSI_KEY_NONE;
+    } else {
+        if (!dev->has_rssi)
+            dev->rssi = sample * 16;
+        else
+            dev->rssi += (sample * 16 - dev->rssi) / RSSI_SMOOTHING_DIVISOR;
+        dev->has_rssi = true;
+
+        key = dev->rssi / 16;
+        if (dev->rssi_key != RSSI_KEY_NONE && abs(key - dev->rssi_key) < RSSI_HYSTERESIS_DB)
+            return false;
+    }
+    if (key == dev->rssi_key)
+        return false;
+
+    u32 from = pair_order_find(pd, dev_index);
+    dev->rssi_key = key;
+    if (from == pd->num_pair_order)
+        return false;
+
+    pd->num_pair_order--;
+    memmove(&pd->pair_order[from], &pd->pair_order[from + 1], sizeof(u32) * (pd->num_pair_order - from));
+    u32 to = pair_order_position(pd, key);
+    memmove(&pd->pair_order[to + 1], &pd->pair_order[to], sizeof(u32) * (pd->num_pair_order - to));
+    pd->pair_order[to] = dev_index;
+    pd->num_pair_order++;
+
+    if (from == to)
+        return false;
+    // entries may only show one adapter's devices, so find the row and its
+    // new slot among the rows rather than assuming they match pair_order
+    if (pd->state == PAIR) {
+        u32 row = pd->num_entries, slot = 0;
+        for (u32 i = 0; i < pd->num_entries; i++) {
+            if ((pd->entries[i].flags & ~ENTRY_ALLOCATED) == ENTRY_DEVICE && pd->entries[i].device == dev_index)
+                row = i;
+        }
+        if (row == pd->num_entries)
+            return false;
+        Entry moved = pd->entries[row];
+        memmove(&pd->entries[row], &pd->entries[row + 1], sizeof(Entry) * (pd->num_entries - row - 1));
+        while (slot < pd->num_entries - 1 && (pd->entries[slot].flags & ~ENTRY_ALLOCATED) == ENTRY_DEVICE &&
+               pd->devices[pd->entries[slot].device].rssi_key >= key)
+            slot++;
+        memmove(&pd->entries[slot + 1], &pd->entries[slot], sizeof(Entry) * (pd->num_entries - slot - 1));
+        pd->entries[slot] = moved;
+        return row != slot;
+    }
+    return true;
 }
 
 internal void update_entries(BluetoothModePrivateData *pd) {
 
+    PROBE2(entries_begin, pd->state, pd->num_devices);
     if (pd->state == LIST) {
-        resize_entries_if_needed(pd, pd->num_paired_devices + (pd->controller != NULL) * 3 + 1);
+        u32 num_controller_props = (pd->controller != NULL) * 3;
+        u32 num_adapter = g_hash_table_size(pd->controllers) > 1;
+        u32 num_paired = 0;
+        for (u32 j = 0; j < pd->num_devices; j++)
+            num_paired += pd->devices[j].paired && device_on_controller(pd, &pd->devices[j]);
+        resize_entries_if_needed(pd, num_paired + 1 + num_adapter + num_controller_props + 2);
         u32 i = 0;
         for (u32 j = 0; j < pd->num_devices; j++) {
             Device *device = &pd->devices[j];
-            if (device->paired) {
-                u64 nb = strlen(device->name);
-                u64 nub = g_utf8_strlen(device->name, nb);
-                g_debug("extra offset: %d", (u32) (20 + nb - nub));
-                set_entry(ENTRY(i), g_strdup_printf("%-*s%-10s", (u32) (20 + nb - nub), device->name, TF(device->connected)),
-                          ENTRY_DEVICE | ENTRY_ALLOCATED, j);
+            if (device->paired && device_on_controller(pd, device)) {
+                set_entry(ENTRY(i), device_row_text(pd, device), ENTRY_DEVICE | ENTRY_ALLOCATED, j);
                 i++;
             }
         }
         set_entry(ENTRY(i), " Pair Device", ENTRY_MENU_PAIR, 0);
         i++;
-        for (; i < pd->num_entries; i++) {
-            u32 a = i - pd->num_paired_devices - 1;
+        if (num_adapter) {
+            set_entry(ENTRY(i), g_strdup_printf("Adapter: %s", pd->controller->name), ENTRY_ADAPTER | ENTRY_ALLOCATED,
+                      0);
+            i++;
+        }
+        for (u32 a = 0; a < num_controller_props; a++, i++) {
             set_entry(ENTRY(i), g_strdup_printf("%s: %s", controller_props[a], C_TF(a)),
                       ENTRY_CONTROLLER_PROP | ENTRY_ALLOCATED, a);
         }
-        // TODO(rahul): maybe cleanup because this is ugly
-        pd->entries[--i].flags = ENTRY_SCAN | ENTRY_ALLOCATED;
+        // the last controller property, Discovering, is toggled by scanning
+        if (num_controller_props)
+            pd->entries[i - 1].flags = ENTRY_SCAN | ENTRY_ALLOCATED;
+        set_entry(ENTRY(i++), "Connect Audio Devices", ENTRY_CONNECT_AUDIO, 0);
+        set_entry(ENTRY(i++), "Disconnect All", ENTRY_DISCONNECT_ALL, 0);
     } else if (pd->state == PAIR) {
-        u32 num_unpaired_devices = pd->num_devices - pd->num_paired_devices;
-        resize_entries_if_needed(pd, num_unpaired_devices + 1);
+        u32 num_unpaired = 0;
+        for (u32 k = 0; k < pd->num_pair_order; k++)
+            num_unpaired += device_on_controller(pd, &pd->devices[pd->pair_order[k]]);
+        resize_entries_if_needed(pd, num_unpaired + 1);
         u32 i = 0;
-        for (u32 j = 0; j < pd->num_devices; j++) {
+        for (u32 k = 0; k < pd->num_pair_order; k++) {
+            u32 j = pd->pair_order[k];
             Device *device = &pd->devices[j];
-            if (!device->paired) {
-                set_entry(ENTRY(i), g_strdup_printf("%-20s%-s", device->address, device->name),
-                          ENTRY_DEVICE | ENTRY_ALLOCATED, j);
-                i++;
-            }
+            if (!device_on_controller(pd, device))
+                continue;
+            set_entry(ENTRY(i), g_strdup_printf("%-20s%-s", device->address, device->name),
+                      ENTRY_DEVICE | ENTRY_ALLOCATED, j);
+            i++;
         }
         set_entry(ENTRY(i), " Back", ENTRY_MENU_LIST, 0);
     } else if (pd->state == DEVICE) {
         Device *dev = &pd->devices[pd->current_device];
 
-        if (dev->paired) {
-            resize_entries_if_needed(pd, 4);
-            set_entry(ENTRY(0), DS(0, dev->connected), ENTRY_DEVICE_CONNECT, pd->current_device);
-            set_entry(ENTRY(2), DS(2, dev->trusted), ENTRY_DEVICE_PROP, 2);
-        } else
-            resize_entries_if_needed(pd, 2);
-        u32 pair_index = (pd->num_entries >> 1) - 1;
-        set_entry(ENTRY(pair_index), DS(1, dev->paired), ENTRY_DEVICE_PAIR, pd->current_device);
-        set_entry(ENTRY(pd->num_entries - 1), " Back", ENTRY_MENU_LIST, 0);
+        if (dev->paired) {
+            resize_entries_if_needed(pd, 4);
+            set_entry(ENTRY(0), DS(0, dev->connected), ENTRY_DEVICE_CONNECT, pd->current_device);
+            set_entry(ENTRY(1), DS(1, dev->paired), ENTRY_DEVICE_PAIR, pd->current_device);
+            set_entry(ENTRY(2), DS(2, dev->trusted), ENTRY_DEVICE_PROP, 2);
+        } else {
+            resize_entries_if_needed(pd, 3);
+            set_entry(ENTRY(0), DS(1, dev->paired), ENTRY_DEVICE_PAIR, pd->current_device);
+            set_entry(ENTRY(1), "Pair, Trust and Connect", ENTRY_DEVICE_PAIR_CONNECT, pd->current_device);
+        }
+        set_entry(ENTRY(pd->num_entries - 1), " Back", ENTRY_MENU_LIST, 0);
+    } else if (pd->state == AGENT) {
+        // passkey and pin code requests are answered with typed input, so
+        // they get no rows a typed code could match; Escape rejects them
+        if (pd->agent.request == AGENT_REQUEST_CONFIRMATION || pd->agent.request == AGENT_REQUEST_AUTHORIZATION) {
+            resize_entries_if_needed(pd, 2);
+            set_entry(ENTRY(0), "Confirm", ENTRY_AGENT_ACCEPT, 0);
+            set_entry(ENTRY(1), "Reject", ENTRY_AGENT_REJECT, 0);
+        } else {
+            resize_entries_if_needed(pd, 0);
+        }
+    }
+    PROBE2(entries_end, pd->state, pd->num_entries);
+}
+
+// from the request pool below
+internal Request *request_new(BluetoothModePrivateData *pd);
+internal void request_release(void *user_data);
+internal f64 request_finish(Request *req);
+
+/** DISCOVERY FILTER **/
+
+internal void discovery_filter_setup(DBusMessageIter *iter, void *user_data) {
+    Request *req = user_data;
+    DiscoveryFilter *filter = &req->pd->filter;
+    DBusMessageIter dict;
+
+    dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+                                     DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING DBUS_TYPE_STRING_AS_STRING
+                                         DBUS_TYPE_VARIANT_AS_STRING DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+                                     &dict);
+    if (filter->transport)
+        g_dbus_dict_append_entry(&dict, "Transport", DBUS_TYPE_STRING, &filter->transport);
+    if (filter->has_rssi) {
+        dbus_int16_t rssi = filter->rssi;
+        g_dbus_dict_append_entry(&dict, "RSSI", DBUS_TYPE_INT16, &rssi);
+    }
+    if (filter->num_uuids)
+        g_dbus_dict_append_array(&dict, "UUIDs", DBUS_TYPE_STRING, &filter->uuids, filter->num_uuids);
+    if (filter->pattern && *filter->pattern)
+        g_dbus_dict_append_entry(&dict, "Pattern", DBUS_TYPE_STRING, &filter->pattern);
+    dbus_message_iter_close_container(iter, &dict);
+}
+
+internal void discovery_filter_push(BluetoothModePrivateData *pd);
+
+internal void discovery_filter_callback(DBusMessage *message, void *user_data) {
+    Request *req = user_data;
+    BluetoothModePrivateData *pd = req->pd;
+    DBusError err;
+
+    request_finish(req);
+    if (pd == NULL)
+        return;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("SetDiscoveryFilter failed: %s", err.message);
+        dbus_error_free(&err);
+    }
+
+    pd->filter.in_flight = false;
+    if (pd->filter.dirty)
+        discovery_filter_push(pd);
+}
+
+// At most one SetDiscoveryFilter is in flight; changes made meanwhile are
+// coalesced into a single follow-up call.
+internal void discovery_filter_push(BluetoothModePrivateData *pd) {
+    DiscoveryFilter *filter = &pd->filter;
+
+    if (pd->controller == NULL)
+        return;
+    if (filter->in_flight) {
+        filter->dirty = true;
+        return;
+    }
+
+    Request *req = request_new(pd);
+    if (g_dbus_proxy_method_call(pd->controller->remote_proxy, "SetDiscoveryFilter", discovery_filter_setup,
+                                 discovery_filter_callback, req, request_release) == false) {
+        request_release(req);
+        return;
+    }
+    filter->in_flight = true;
+    filter->dirty = false;
+}
+
+internal void discovery_filter_set_pattern(BluetoothModePrivateData *pd, const char *pattern) {
+    DiscoveryFilter *filter = &pd->filter;
+
+    if (!g_strcmp0(filter->pattern ? filter->pattern : "", pattern))
+        return;
+    g_free(filter->pattern);
+    filter->pattern = g_strdup(pattern);
+    discovery_filter_push(pd);
+}
+
+internal void discovery_filter_init(DiscoveryFilter *filter) {
+    char *transport = NULL;
+    char *uuids = NULL;
+    int rssi;
+
+    if (find_arg_str("-bluetooth-transport", &transport))
+        filter->transport = g_strdup(transport);
+    if (find_arg_int("-bluetooth-rssi", &rssi)) {
+        if (rssi >= DISCOVERY_RSSI_MIN && rssi <= DISCOVERY_RSSI_MAX) {
+            filter->has_rssi = true;
+            filter->rssi = rssi;
+        } else {
+            g_warning("ignoring -bluetooth-rssi %d, must be %d to %d dBm", rssi, DISCOVERY_RSSI_MIN,
+                      DISCOVERY_RSSI_MAX);
+        }
+    }
+    // BlueZ matches Pattern as a prefix of the address or name, not as
+    // rofi's substring match: "sony" would hide "WH-1000XM4 Sony" from
+    // discovery, so this stays opt-in
+    filter->prefix = find_arg("-bluetooth-scan-prefix") >= 0;
+    if (find_arg_str("-bluetooth-uuids", &uuids)) {
+        filter->uuids = g_strsplit(uuids, ",", -1);
+        filter->num_uuids = g_strv_length(filter->uuids);
+    }
+}
+
+internal void discovery_filter_destroy(DiscoveryFilter *filter) {
+    g_free(filter->transport);
+    g_strfreev(filter->uuids);
+    g_free(filter->pattern);
+}
+
+/** DISCOVERY SESSION **/
+
+internal void discovery_send(BluetoothModePrivateData *pd, const char *method) {
+    if (pd->controller)
+        g_dbus_proxy_method_call(pd->controller->remote_proxy, method, NULL, NULL, NULL, NULL);
+}
+
+internal void discovery_session_end(BluetoothModePrivateData *pd) {
+    DiscoverySession *session = &pd->discovery;
+
+    if (session->timer) {
+        g_source_remove(session->timer);
+        session->timer = 0;
+    }
+    session->active = false;
+    session->paused = false;
+}
+
+// Ends the session on the adapter it was started on; callers switching
+// adapters must do this first, or the old one keeps scanning.
+internal void discovery_session_stop(BluetoothModePrivateData *pd) {
+    if (pd->discovery.active && !pd->discovery.paused)
+        discovery_send(pd, "StopDiscovery");
+    discovery_session_end(pd);
+}
+
+internal gboolean discovery_session_tick(gpointer user_data) {
+    BluetoothModePrivateData *pd = user_data;
+    DiscoverySession *session = &pd->discovery;
+    u32 elapsed = (g_get_monotonic_time() - session->start) / 1000;
+    u32 next;
+
+    session->timer = 0;
+    if (session->max_duration_ms && elapsed >= session->max_duration_ms) {
+        discovery_session_stop(pd);
+        reload_view();
+        return G_SOURCE_REMOVE;
+    }
+
+    if (session->paused) {
+        discovery_filter_push(pd);
+        discovery_send(pd, "StartDiscovery");
+        next = session->on_ms;
+    } else {
+        discovery_send(pd, "StopDiscovery");
+        next = session->off_ms;
+    }
+    session->paused = !session->paused;
+
+    if (session->max_duration_ms && elapsed + next > session->max_duration_ms)
+        next = session->max_duration_ms - elapsed;
+    session->timer = g_timeout_add(next, discovery_session_tick, pd);
+    return G_SOURCE_REMOVE;
+}
+
+// Called once StartDiscovery has been requested from the menu.
+internal void discovery_session_begin(BluetoothModePrivateData *pd) {
+    DiscoverySession *session = &pd->discovery;
+    u32 next = session->on_ms && session->off_ms ? session->on_ms : session->max_duration_ms;
+
+    discovery_session_end(pd);
+    session->active = true;
+    session->start = g_get_monotonic_time();
+    session->first_result = 0;
+    session->devices_found = 0;
+    session->signals = 0;
+
+    if (session->max_duration_ms && next > session->max_duration_ms)
+        next = session->max_duration_ms;
+    if (next)
+        session->timer = g_timeout_add(next, discovery_session_tick, pd);
+}
+
+internal b32 discovery_session_matches(DiscoverySession *session, Device *dev) {
+    if (session->target == NULL)
+        return false;
+    if (dev->address && !g_ascii_strncasecmp(dev->address, session->target, strlen(session->target)))
+        return true;
+    return dev->name && strstr(dev->name, session->target);
+}
+
+internal void discovery_session_device_found(BluetoothModePrivateData *pd, Device *dev) {
+    DiscoverySession *session = &pd->discovery;
+
+    if (!session->active)
+        return;
+    session->signals++;
+    session->devices_found++;
+    if (session->first_result == 0)
+        session->first_result = g_get_monotonic_time();
+
+    if (discovery_session_matches(session, dev)) {
+        g_debug("discovery target %s found, stopping", session->target);
+        discovery_session_stop(pd);
+    }
+}
+
+internal char *discovery_session_stats(BluetoothModePrivateData *pd) {
+    DiscoverySession *session = &pd->discovery;
+    char first[32] = "-";
+
+    if (session->start == 0)
+        return NULL;
+    if (session->first_result)
+        g_snprintf(first, sizeof(first), "%.2fs", (session->first_result - session->start) / 1e6);
+    return g_strdup_printf("<i>Scan%s: %u found, %" G_GUINT64_FORMAT " signals, first result %s</i>\n",
+                           !session->active ? " done" : session->paused ? " paused" : "", session->devices_found,
+                           session->signals, first);
+}
+
+internal void discovery_session_init(DiscoverySession *session) {
+    char *duty = NULL;
+    char *target = NULL;
+    u32 timeout = 0;
+
+    if (find_arg_uint("-bluetooth-scan-timeout", &timeout))
+        session->max_duration_ms = timeout * 1000;
+    // -bluetooth-scan-duty <on>:<off>, both in seconds
+    if (find_arg_str("-bluetooth-scan-duty", &duty)) {
+        u32 on = 0, off = 0;
+        if (sscanf(duty, "%u:%u", &on, &off) == 2 && on && off) {
+            session->on_ms = on * 1000;
+            session->off_ms = off * 1000;
+        }
+    }
+    if (find_arg_str("-bluetooth-scan-until", &target))
+        session->target = g_strdup(target);
+}
+
+internal void discovery_session_destroy(BluetoothModePrivateData *pd) {
+    discovery_session_end(pd);
+    g_free(pd->discovery.target);
+}
+
+/** AGENT REGISTRATION **/
+
+internal void request_default_agent_callback(DBusMessage *message, void *user_data) {
+    DBusError err;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("failed to become default agent: %s", err.message);
+        dbus_error_free(&err);
+    }
+}
+
+internal void agent_path_setup(DBusMessageIter *iter, void *user_data) {
+    const char *path = AGENT_PATH;
+    dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+}
+
+internal void register_agent_setup(DBusMessageIter *iter, void *user_data) {
+    const char *capability = AGENT_CAPABILITY;
+    agent_path_setup(iter, user_data);
+    dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &capability);
+}
+
+internal void register_agent_callback(DBusMessage *message, void *user_data) {
+    BluetoothModePrivateData *pd = user_data;
+    DBusError err;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("failed to register agent: %s", err.message);
+        dbus_error_free(&err);
+        return;
+    }
+
+    pd->agent_registered = true;
+    g_dbus_proxy_method_call(pd->agent_manager, "RequestDefaultAgent", agent_path_setup,
+                             request_default_agent_callback, NULL, NULL);
+}
+
+internal void register_agent(BluetoothModePrivateData *pd) {
+    if (pd->agent_registered)
+        return;
+    g_dbus_proxy_method_call(pd->agent_manager, "RegisterAgent", register_agent_setup, register_agent_callback, pd,
+                             NULL);
+}
+
+// Unordered remove from the device table, keeping the pair order and the
+// current device index valid.
+internal void device_unlink(BluetoothModePrivateData *pd, u32 dev_index) {
+    if (pd->devices[dev_index].paired)
+        pd->num_paired_devices--;
+    else
+        pair_order_remove(pd, dev_index);
+    pd->devices[dev_index] = pd->devices[--pd->num_devices];
+    memstat_add(MEMSTAT_DEVICE, 0, -1);
+    pair_order_renumber(pd, pd->num_devices, dev_index);
+    if (pd->current_device == pd->num_devices)
+        pd->current_device = dev_index;
+}
+
+internal u32 device_add(BluetoothModePrivateData *pd, GDBusProxy *proxy) {
+    const char *path = g_dbus_proxy_get_path(proxy);
+
+    // the real proxy replaces the row the daemon snapshot put up
+    if (pd->snapshot) {
+        for (u32 i = 0; i < pd->num_devices; i++) {
+            if (pd->devices[i].remote_proxy == NULL && !strcmp(pd->devices[i].path, path)) {
+                device_unlink(pd, i);
+                break;
+            }
+        }
+    }
+
+    grow_devices_if_needed(pd);
+    Device *dev = &pd->devices[pd->num_devices];
+    dev->remote_proxy = proxy;
+    dev->path = path;
+    get_property(proxy, "Address", &dev->address);
+    get_property(proxy, "Alias", &dev->name);
+    dev->icon = NULL;
+    get_property(proxy, "Icon", &dev->icon);
+    get_property(proxy, "Connected", &dev->connected);
+    get_property(proxy, "Paired", &dev->paired);
+    get_property(proxy, "Trusted", &dev->trusted);
+    dev->adapter = NULL;
+    get_property(proxy, "Adapter", &dev->adapter);
+    dev->last_seen = g_get_monotonic_time();
+
+    DBusMessageIter rssi_iter;
+    dev->has_rssi = false;
+    dev->rssi_key = RSSI_KEY_NONE;
+    if (g_dbus_proxy_get_property(proxy, "RSSI", &rssi_iter)) {
+        dbus_int16_t rssi;
+        dbus_message_iter_get_basic(&rssi_iter, &rssi);
+        dev->has_rssi = true;
+        dev->rssi = rssi * 16;
+        dev->rssi_key = rssi;
+    }
+
+    debug_print_device(dev);
+    pd->num_devices++;
+    memstat_add(MEMSTAT_DEVICE, 0, 1);
+    if (dev->paired)
+        pd->num_paired_devices++;
+    else
+        pair_order_insert(pd, pd->num_devices - 1);
+    return pd->num_devices - 1;
+}
+
+/** EVICTION **/
+
+internal b32 device_evictable(BluetoothModePrivateData *pd, u32 dev_index) {
+    Device *dev = &pd->devices[dev_index];
+
+    if (dev->remote_proxy == NULL || dev->paired || dev->connected)
+        return false;
+    if ((pd->state == DEVICE || pd->agent.return_state == DEVICE) && pd->current_device == dev_index)
+        return false;
+    if (pd->pipeline && pd->pipeline->proxy == dev->remote_proxy)
+        return false;
+    return !g_hash_table_contains(pd->operations, dev->remote_proxy);
+}
+
+internal void remove_stale_device_setup(DBusMessageIter *iter, void *user_data) {
+    const char *path = user_data;
+    dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+}
+
+// Drops the device from the plugin model. Its proxy stays cached by the
+// client unless -bluetooth-remove-stale also has BlueZ forget it; either
+// way the next signal from it re-adds it.
+internal void device_evict(BluetoothModePrivateData *pd, u32 dev_index) {
+    Device *dev = &pd->devices[dev_index];
+
+    g_debug("evicting %s", dev->address);
+    Controller *controller = device_controller(pd, dev);
+    if (pd->eviction.remove && controller)
+        g_dbus_proxy_method_call(controller->remote_proxy, "RemoveDevice", remove_stale_device_setup, NULL,
+                                 (void *)g_dbus_proxy_get_path(dev->remote_proxy), NULL);
+
+    device_unlink(pd, dev_index);
+    pd->eviction.evicted++;
+}
+
+// Evicts least recently seen unpaired devices until the cap holds.
+internal b32 eviction_enforce_cap(BluetoothModePrivateData *pd) {
+    EvictionPolicy *policy = &pd->eviction;
+    b32 evicted = false;
+
+    if (policy->max_unpaired == 0)
+        return false;
+    while (pd->num_pair_order > policy->max_unpaired) {
+        u32 oldest = pd->num_devices;
+        for (u32 i = 0; i < pd->num_pair_order; i++) {
+            u32 j = pd->pair_order[i];
+            if (!device_evictable(pd, j))
+                continue;
+            if (oldest == pd->num_devices || pd->devices[j].last_seen < pd->devices[oldest].last_seen)
+                oldest = j;
+        }
+        if (oldest == pd->num_devices)
+            break;
+        device_evict(pd, oldest);
+        evicted = true;
+    }
+    return evicted;
+}
+
+internal gboolean eviction_sweep(gpointer user_data) {
+    BluetoothModePrivateData *pd = user_data;
+    i64 cutoff = g_get_monotonic_time() - (i64)pd->eviction.stale_seconds * G_USEC_PER_SEC;
+    b32 evicted = false;
+
+    // walk backwards so entries swapped in by an eviction have been visited
+    for (u32 i = pd->num_pair_order; i-- > 0;) {
+        u32 j = pd->pair_order[i];
+        if (pd->devices[j].last_seen < cutoff && device_evictable(pd, j)) {
+            device_evict(pd, j);
+            evicted = true;
+        }
+    }
+    if (evicted) {
+        update_entries(pd);
+        reload_view();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+internal void eviction_init(BluetoothModePrivateData *pd) {
+    EvictionPolicy *policy = &pd->eviction;
+
+    policy->max_unpaired = EVICTION_DEFAULT_MAX_UNPAIRED;
+    policy->stale_seconds = EVICTION_DEFAULT_STALE_SECONDS;
+    find_arg_uint("-bluetooth-max-unpaired", &policy->max_unpaired);
+    find_arg_uint("-bluetooth-stale", &policy->stale_seconds);
+    policy->remove = find_arg("-bluetooth-remove-stale") >= 0;
+
+    if (policy->stale_seconds)
+        policy->timer = g_timeout_add_seconds(MAX(policy->stale_seconds / 4, 1), eviction_sweep, pd);
+}
+
+internal void eviction_destroy(BluetoothModePrivateData *pd) {
+    if (pd->eviction.timer)
+        g_source_remove(pd->eviction.timer);
+    g_debug("evicted %u stale devices", pd->eviction.evicted);
+}
+
+/** SNAPSHOT **/
+
+internal int snapshot_connect(void) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    char *path = snapshot_socket_path();
+    int fd = -1;
+
+    // non-blocking so a wedged daemon with a full backlog can't stall rofi
+    if (strlen(path) < sizeof(addr.sun_path)) {
+        strcpy(addr.sun_path, path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd >= 0 && (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || !snapshot_peer_is_self(fd))) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    g_free(path);
+    return fd;
+}
+
+// Seeds the device table from rofi-bluetoothd so the first frame has the
+// full list. The rows have no proxy yet: device_add swaps each one for the
+// real device as the client enumerates BlueZ, and whatever is left when
+// the client is ready is dropped. Without the daemon, or if it does not
+// answer within SNAPSHOT_READ_TIMEOUT_MS, this does nothing.
+internal void snapshot_load(BluetoothModePrivateData *pd) {
+    SnapshotHeader header;
+    SnapshotReader reader;
+    SnapshotRecord record;
+    u32 num_records;
+    i64 start = g_get_monotonic_time();
+
+    if (find_arg("-bluetooth-no-daemon") >= 0)
+        return;
+    int fd = snapshot_connect();
+    if (fd < 0)
+        return;
+
+    b32 ok = snapshot_read_frame(fd, &header, &pd->snapshot, start + SNAPSHOT_READ_TIMEOUT_MS * 1000);
+    close(fd);
+    if (!ok || header.type != SNAPSHOT_FRAME_FULL) {
+        g_free(pd->snapshot);
+        pd->snapshot = NULL;
+        return;
+    }
+
+    reader = (SnapshotReader){.data = pd->snapshot, .size = header.length, .offset = 0};
+    if (!snapshot_read_u32(&reader, &num_records))
+        return;
+    for (u32 r = 0; r < num_records && snapshot_read_record(&reader, &record); r++) {
+        if (record.kind != SNAPSHOT_KIND_DEVICE || record.path == NULL)
+            continue;
+        grow_devices_if_needed(pd);
+        Device *dev = &pd->devices[pd->num_devices];
+        memset(dev, 0, sizeof(*dev));
+        dev->path = record.path;
+        dev->adapter = (char *)record.adapter;
+        dev->address = (char *)(record.address ? record.address : record.path);
+        dev->name = (char *)(record.name ? record.name : dev->address);
+        dev->icon = (char *)record.icon;
+        dev->connected = !!(record.flags & SNAPSHOT_FLAG_CONNECTED);
+        dev->paired = !!(record.flags & SNAPSHOT_FLAG_PAIRED);
+        dev->trusted = !!(record.flags & SNAPSHOT_FLAG_TRUSTED);
+        dev->has_rssi = !!(record.flags & SNAPSHOT_FLAG_HAS_RSSI);
+        dev->rssi = record.rssi * 16;
+        dev->rssi_key = dev->has_rssi ? record.rssi : RSSI_KEY_NONE;
+        dev->last_seen = start;
+
+        pd->num_devices++;
+        memstat_add(MEMSTAT_DEVICE, 0, 1);
+        if (dev->paired)
+            pd->num_paired_devices++;
+        else
+            pair_order_insert(pd, pd->num_devices - 1);
+    }
+    g_debug("loaded %u devices from the daemon in %.2fms", pd->num_devices, (g_get_monotonic_time() - start) / 1e3);
+    update_entries(pd);
+}
+
+internal void client_ready(GDBusClient *client, void *user_data) {
+    Mode *sw = (Mode *)user_data;
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    if (pd == NULL || pd->snapshot == NULL)
+        return;
+    // walk backwards so rows swapped in by an unlink have been visited
+    for (u32 i = pd->num_devices; i-- > 0;) {
+        if (pd->devices[i].remote_proxy == NULL)
+            device_unlink(pd, i);
+    }
+    g_free(pd->snapshot);
+    pd->snapshot = NULL;
+    update_entries(pd);
+    reload_view();
+}
+
+internal void proxy_added(GDBusProxy *proxy, void *user_data) {
+    const char *interface;
+    Mode *sw = (Mode *)user_data;
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    interface = g_dbus_proxy_get_interface(proxy);
+    if (!strcmp(interface, "org.bluez.Device1")) {
+        Device *dev = &pd->devices[device_add(pd, proxy)];
+        discovery_session_device_found(pd, dev);
+        b32 visible = device_on_controller(pd, dev);
+        // eviction may move devices around, so dev is not used past here
+        b32 evicted = eviction_enforce_cap(pd);
+        if (visible || evicted) {
+            update_entries(pd);
+            reload_view();
+        }
+    } else if (!strcmp(interface, "org.bluez.Adapter1")) {
+        if (!find_controller(pd, proxy)) {
+            b32 b = true;
+            Controller *controller = g_malloc0(sizeof(Controller));
+            controller->remote_proxy = proxy;
+            controller->path = g_dbus_proxy_get_path(proxy);
+            controller->name = (char *)controller->path;
+            g_dbus_proxy_set_property_basic(proxy, "Pairable", DBUS_TYPE_BOOLEAN, &b, NULL, NULL, NULL);
+            get_property(proxy, "Alias", &controller->name);
+            get_property(proxy, "Powered", &controller->powered);
+            get_property(proxy, "Discoverable", &controller->discoverable);
+            get_property(proxy, "Discovering", &controller->discovering);
+            g_hash_table_insert(pd->controllers, (gpointer)controller->path, controller);
+
+            // the first adapter seen stays selected until the user switches
+            if (!pd->controller)
+                pd->controller = controller;
+
+            debug_print_controller(controller);
+            update_entries(pd);
+            reload_view();
+        }
+    } else if (!strcmp(interface, AGENT_MANAGER_INTERFACE)) {
+        pd->agent_manager = proxy;
+        register_agent(pd);
+    }
+}
+
+inline internal u32 find_device(GDBusProxy *proxy, Device *devices, u32 num_devices) {
+
+    u32 i = 0;
+    for (; i < num_devices; i++) {
+        if (devices[i].remote_proxy == proxy)
+            break;
+    }
+
+    return i;
+}
+
+/** PIPELINE **/
+
+internal void pipeline_connect(Pipeline *pipeline);
+
+internal void pipeline_unref(Pipeline *pipeline) {
+    if (--pipeline->outstanding > 0 || (pipeline->pd && pipeline->pd->pipeline == pipeline))
+        return;
+    g_dbus_proxy_unref(pipeline->proxy);
+    g_free(pipeline);
+}
+
+// Replies still in flight may outlive pd, so the pipeline forgets it too.
+internal void pipeline_detach(Pipeline *pipeline) {
+    BluetoothModePrivateData *pd = pipeline->pd;
+
+    pd->pipeline = NULL;
+    pipeline->pd = NULL;
+    if (pipeline->outstanding == 0) {
+        g_dbus_proxy_unref(pipeline->proxy);
+        g_free(pipeline);
+    }
+}
+
+internal void pipeline_fail(Pipeline *pipeline, u32 step) {
+    BluetoothModePrivateData *pd = pipeline->pd;
+
+    if (pd == NULL || pd->pipeline != pipeline)
+        return;
+
+    g_free(pd->command_status);
+    pd->command_status =
+        g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s after %.2fs\n",
+                        pipeline_step_strings[step][0], (g_get_monotonic_time() - pipeline->start) / 1e6);
+    pipeline_detach(pipeline);
+    reload_view();
+}
+
+internal void pipeline_step_done(Pipeline *pipeline, u32 step) {
+    BluetoothModePrivateData *pd = pipeline->pd;
+
+    if (pd == NULL || pd->pipeline != pipeline || !(pipeline->pending & (1 << step)))
+        return;
+
+    pipeline->pending &= ~(1 << step);
+    pipeline->step_time[step] = g_get_monotonic_time() - pipeline->step_start[step];
+
+    if (pipeline->pending == (1 << PIPELINE_CONNECT)) {
+        pipeline_connect(pipeline);
+        return;
+    }
+    if (pipeline->pending)
+        return;
+
+    GString *status = g_string_new("<span foreground=\"green\" weight=\"bold\">Success:</span>");
+    for (u32 i = 0; i < PIPELINE_NUM_STEPS; i++)
+        g_string_append_printf(status, " %s (%.2fs)", pipeline_step_strings[i][1], pipeline->step_time[i] / 1e6);
+    g_string_append_printf(status, " in %.2fs\n", (g_get_monotonic_time() - pipeline->start) / 1e6);
+
+    g_free(pd->command_status);
+    pd->command_status = g_string_free(status, false);
+    pipeline_detach(pipeline);
+    reload_view();
+}
+
+internal void pipeline_reply(Pipeline *pipeline, u32 step, DBusMessage *message) {
+    DBusError err;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("pipeline %s failed: %s", pipeline_step_strings[step][0], err.message);
+        dbus_error_free(&err);
+        pipeline_fail(pipeline, step);
+    } else
+        pipeline_step_done(pipeline, step);
+    pipeline_unref(pipeline);
+}
+
+internal void pipeline_pair_callback(DBusMessage *message, void *user_data) {
+    pipeline_reply(user_data, PIPELINE_PAIR, message);
+}
+
+internal void pipeline_connect_callback(DBusMessage *message, void *user_data) {
+    pipeline_reply(user_data, PIPELINE_CONNECT, message);
+}
+
+internal void pipeline_trust_callback(const DBusError *error, void *user_data) {
+    Pipeline *pipeline = user_data;
+
+    if (dbus_error_is_set(error))
+        pipeline_fail(pipeline, PIPELINE_TRUST);
+    else
+        pipeline_step_done(pipeline, PIPELINE_TRUST);
+    pipeline_unref(pipeline);
+}
+
+internal void pipeline_connect(Pipeline *pipeline) {
+    pipeline->step_start[PIPELINE_CONNECT] = g_get_monotonic_time();
+    pipeline->connect_sent = true;
+    pipeline->outstanding++;
+    if (g_dbus_proxy_method_call(pipeline->proxy, "Connect", NULL, pipeline_connect_callback, pipeline, NULL) ==
+        false) {
+        pipeline->outstanding--;
+        pipeline_fail(pipeline, PIPELINE_CONNECT);
+    }
+}
+
+internal void pipeline_start(BluetoothModePrivateData *pd, Device *dev) {
+    b32 trusted = true;
+
+    // one onboarding at a time, a second request is turned away
+    if (pd->pipeline) {
+        u32 busy = find_device(pd->pipeline->proxy, pd->devices, pd->num_devices);
+        g_free(pd->command_status);
+        pd->command_status =
+            g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Busy onboarding %s\n",
+                            busy != pd->num_devices ? pd->devices[busy].name : "another device");
+        return;
+    }
+
+    Pipeline *pipeline = g_malloc0(sizeof(Pipeline));
+    pipeline->pd = pd;
+    pipeline->proxy = g_dbus_proxy_ref(dev->remote_proxy);
+    pipeline->start = g_get_monotonic_time();
+    for (u32 i = 0; i < PIPELINE_NUM_STEPS; i++)
+        pipeline->step_start[i] = pipeline->start;
+    pipeline->pending = (!dev->paired << PIPELINE_PAIR) | (!dev->trusted << PIPELINE_TRUST) |
+                        (!dev->connected << PIPELINE_CONNECT);
+    pd->pipeline = pipeline;
+
+    g_free(pd->command_status);
+    pd->command_status = g_strdup_printf("<b>Pairing, trusting and connecting %s</b>\n", dev->name);
+
+    // Trusted can be set before the device is paired, so both go out together
+    if (pipeline->pending & (1 << PIPELINE_PAIR)) {
+        pipeline->outstanding++;
+        if (g_dbus_proxy_method_call(pipeline->proxy, "Pair", NULL, pipeline_pair_callback, pipeline, NULL) ==
+            false) {
+            pipeline->outstanding--;
+            pipeline_fail(pipeline, PIPELINE_PAIR);
+            return;
+        }
+    }
+    if (pipeline->pending & (1 << PIPELINE_TRUST)) {
+        pipeline->outstanding++;
+        if (g_dbus_proxy_set_property_basic(pipeline->proxy, "Trusted", DBUS_TYPE_BOOLEAN, &trusted,
+                                            pipeline_trust_callback, pipeline, NULL) == false) {
+            pipeline->outstanding--;
+            pipeline_fail(pipeline, PIPELINE_TRUST);
+            return;
+        }
+    }
+    if (pipeline->pending == (1 << PIPELINE_CONNECT)) {
+        pipeline_connect(pipeline);
+    } else if (pipeline->pending == 0) {
+        pipeline->pending = 1 << PIPELINE_CONNECT;
+        pipeline_step_done(pipeline, PIPELINE_CONNECT);
+    }
+}
+
+internal void pipeline_property_changed(BluetoothModePrivateData *pd, GDBusProxy *proxy, const char *name,
+                                        DBusMessageIter *iter) {
+    Pipeline *pipeline = pd->pipeline;
+    dbus_bool_t value;
+    u32 step;
+
+    if (pipeline == NULL || pipeline->proxy != proxy || iter == NULL)
+        return;
+
+    if (!strcmp(name, "Paired"))
+        step = PIPELINE_PAIR;
+    else if (!strcmp(name, "Trusted"))
+        step = PIPELINE_TRUST;
+    else if (!strcmp(name, "Connected") && pipeline->connect_sent)
+        step = PIPELINE_CONNECT;
+    else
+        return;
+
+    if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_BOOLEAN)
+        return;
+    dbus_message_iter_get_basic(iter, &value);
+    if (value)
+        pipeline_step_done(pipeline, step);
+}
+
+/** RECONNECT **/
+
+internal void reconnect_free(Reconnect *r) {
+    BluetoothModePrivateData *pd = r->pd;
+
+    if (r->timer)
+        g_source_remove(r->timer);
+    if (pd) {
+        if (r->waiting)
+            g_queue_remove(&pd->reconnect.waiting, r);
+        g_hash_table_remove(pd->reconnect.devices, r->proxy);
+    }
+    g_dbus_proxy_unref(r->proxy);
+    g_free(r);
+}
+
+internal void reconnect_record(ReconnectScheduler *sched, Reconnect *r) {
+    i64 ms = (g_get_monotonic_time() - r->dropped) / 1000;
+    u32 bucket = 0;
+
+    while (bucket < RECONNECT_HISTOGRAM_BUCKETS - 1 && ms >= (500 << bucket))
+        bucket++;
+    sched->histogram[bucket]++;
+    sched->succeeded++;
+    g_debug("reconnected %s after %" G_GINT64_FORMAT "ms, %u attempts", g_dbus_proxy_get_path(r->proxy), ms,
+            r->attempt);
+}
+
+internal void reconnect_schedule(Reconnect *r);
+internal void reconnect_attempt(Reconnect *r);
+
+internal void reconnect_drain(ReconnectScheduler *sched) {
+    while (sched->active < sched->max_active && !g_queue_is_empty(&sched->waiting)) {
+        Reconnect *r = g_queue_pop_head(&sched->waiting);
+        r->waiting = false;
+        reconnect_attempt(r);
+    }
+}
+
+internal void reconnect_reply(DBusMessage *message, void *user_data) {
+    Reconnect *r = user_data;
+    BluetoothModePrivateData *pd = r->pd;
+    DBusError err;
+    b32 failed = false;
+
+    r->in_flight = false;
+    if (pd == NULL) {
+        reconnect_free(r);
+        return;
+    }
+    pd->reconnect.active--;
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("reconnect attempt %u failed: %s", r->attempt, err.message);
+        dbus_error_free(&err);
+        failed = true;
+    }
+
+    // the device came back on its own, or the user disconnected it, while
+    // the attempt was in flight
+    if (r->done) {
+        if (!r->cancelled)
+            reconnect_record(&pd->reconnect, r);
+        reconnect_free(r);
+    } else if (r->cancelled) {
+        // keep the marker until Connected -> false arrives
+    } else if (!failed) {
+        reconnect_record(&pd->reconnect, r);
+        reconnect_free(r);
+    } else if (++r->attempt >= pd->reconnect.max_attempts) {
+        pd->reconnect.given_up++;
+        reconnect_free(r);
+    } else {
+        reconnect_schedule(r);
+    }
+
+    reconnect_drain(&pd->reconnect);
+}
+
+internal void reconnect_attempt(Reconnect *r) {
+    ReconnectScheduler *sched = &r->pd->reconnect;
+
+    if (sched->active >= sched->max_active) {
+        r->waiting = true;
+        g_queue_push_tail(&sched->waiting, r);
+        return;
+    }
+
+    if (g_dbus_proxy_method_call(r->proxy, "Connect", NULL, reconnect_reply, r, NULL) == false) {
+        if (++r->attempt >= sched->max_attempts) {
+            sched->given_up++;
+            reconnect_free(r);
+        } else {
+            reconnect_schedule(r);
+        }
+        return;
+    }
+    r->in_flight = true;
+    sched->active++;
+}
+
+internal gboolean reconnect_timeout(gpointer user_data) {
+    Reconnect *r = user_data;
+
+    r->timer = 0;
+    reconnect_attempt(r);
+    return G_SOURCE_REMOVE;
+}
+
+// Exponential backoff with the upper half jittered, so devices that dropped
+// together don't retry in lockstep.
+internal void reconnect_schedule(Reconnect *r) {
+    u32 delay = RECONNECT_BASE_DELAY_MS << MIN(r->attempt, 16);
+    if (delay > RECONNECT_MAX_DELAY_MS)
+        delay = RECONNECT_MAX_DELAY_MS;
+    delay = delay / 2 + g_random_int_range(0, delay / 2 + 1);
+
+    r->timer = g_timeout_add(delay, reconnect_timeout, r);
+}
+
+internal void reconnect_connected_changed(BluetoothModePrivateData *pd, Device *dev, b32 was_connected) {
+    ReconnectScheduler *sched = &pd->reconnect;
+    Reconnect *r;
+
+    if (!sched->enabled || was_connected == dev->connected)
+        return;
+
+    r = g_hash_table_lookup(sched->devices, dev->remote_proxy);
+    if (dev->connected) {
+        if (r == NULL)
+            return;
+        if (r->in_flight) {
+            r->done = true;
+            return;
+        }
+        if (!r->cancelled)
+            reconnect_record(sched, r);
+        reconnect_free(r);
+        return;
+    }
+
+    if (r) {
+        // explicit disconnect, nothing to retry
+        if (r->cancelled && !r->in_flight)
+            reconnect_free(r);
+        return;
+    }
+    if (!dev->paired || !dev->trusted)
+        return;
+
+    r = g_malloc0(sizeof(Reconnect));
+    r->pd = pd;
+    r->proxy = g_dbus_proxy_ref(dev->remote_proxy);
+    r->dropped = g_get_monotonic_time();
+    g_hash_table_insert(sched->devices, r->proxy, r);
+    reconnect_schedule(r);
+}
+
+// Called when the user disconnects a device on purpose; any pending retry
+// is dropped and the next Connected -> false is ignored.
+internal void reconnect_cancel(BluetoothModePrivateData *pd, GDBusProxy *proxy) {
+    ReconnectScheduler *sched = &pd->reconnect;
+    Reconnect *r;
+
+    if (!sched->enabled)
+        return;
+
+    r = g_hash_table_lookup(sched->devices, proxy);
+    if (r == NULL) {
+        r = g_malloc0(sizeof(Reconnect));
+        r->pd = pd;
+        r->proxy = g_dbus_proxy_ref(proxy);
+        g_hash_table_insert(sched->devices, r->proxy, r);
+    }
+    r->cancelled = true;
+    if (r->timer) {
+        g_source_remove(r->timer);
+        r->timer = 0;
+    }
+    if (r->waiting) {
+        g_queue_remove(&sched->waiting, r);
+        r->waiting = false;
+    }
+}
+
+internal void reconnect_forget(BluetoothModePrivateData *pd, GDBusProxy *proxy) {
+    Reconnect *r;
+
+    if (!pd->reconnect.enabled)
+        return;
+
+    r = g_hash_table_lookup(pd->reconnect.devices, proxy);
+    if (r == NULL)
+        return;
+    // an attempt in flight is detached and frees itself on reply
+    if (r->in_flight) {
+        g_hash_table_remove(pd->reconnect.devices, proxy);
+        pd->reconnect.active--;
+        r->pd = NULL;
+        reconnect_drain(&pd->reconnect);
+        return;
+    }
+    reconnect_free(r);
+}
+
+internal u32 reconnect_num_pending(ReconnectScheduler *sched) {
+    GHashTableIter iter;
+    Reconnect *r;
+    u32 n = 0;
+
+    g_hash_table_iter_init(&iter, sched->devices);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&r))
+        n += !r->cancelled;
+    return n;
+}
+
+internal void reconnect_init(ReconnectScheduler *sched) {
+    sched->enabled = find_arg("-bluetooth-reconnect") >= 0;
+    sched->max_active = RECONNECT_DEFAULT_MAX_ACTIVE;
+    sched->max_attempts = RECONNECT_DEFAULT_MAX_ATTEMPTS;
+    find_arg_uint("-bluetooth-reconnect-max-active", &sched->max_active);
+    find_arg_uint("-bluetooth-reconnect-attempts", &sched->max_attempts);
+    if (sched->max_active == 0)
+        sched->max_active = 1;
+
+    sched->devices = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_queue_init(&sched->waiting);
+}
+
+internal void reconnect_destroy(ReconnectScheduler *sched) {
+    GHashTableIter iter;
+    Reconnect *r;
+
+    g_debug("reconnects: %u succeeded, %u given up", sched->succeeded, sched->given_up);
+    for (u32 i = 0; i < RECONNECT_HISTOGRAM_BUCKETS; i++)
+        g_debug("  %s%6ums: %u", i == RECONNECT_HISTOGRAM_BUCKETS - 1 ? ">=" : " <",
+                500 << (i == RECONNECT_HISTOGRAM_BUCKETS - 1 ? i - 1 : i), sched->histogram[i]);
+
+    // attempts still in flight are detached and free themselves on reply
+    g_hash_table_iter_init(&iter, sched->devices);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&r)) {
+        g_hash_table_iter_steal(&iter);
+        if (r->timer) {
+            g_source_remove(r->timer);
+            r->timer = 0;
+        }
+        r->waiting = false;
+        r->pd = NULL;
+        if (!r->in_flight)
+            reconnect_free(r);
+    }
+    g_queue_clear(&sched->waiting);
+    g_hash_table_destroy(sched->devices);
+}
+
+/** OPERATIONS **/
+
+internal void operation_free(Operation *op) {
+    if (op->batch && --op->batch->outstanding == 0)
+        g_free(op->batch);
+    g_dbus_proxy_unref(op->proxy);
+    g_free(op);
+}
+
+internal void operation_batch_done(BluetoothModePrivateData *pd, OperationBatch *batch) {
+    u32 succeeded = batch->total - batch->failed;
+
+    g_free(pd->command_status);
+    pd->command_status = g_strdup_printf("<span foreground=\"%s\" weight=\"bold\">%s:</span> %s %u/%u devices in %.2fs\n",
+                                         batch->failed ? "red" : "green", batch->failed ? "Error" : "Success",
+                                         operation_strings[batch->op][3], succeeded, batch->total,
+                                         (g_get_monotonic_time() - batch->start) / 1e6);
+}
+
+internal void operation_callback(DBusMessage *message, void *user_data) {
+    Operation *op = user_data;
+    BluetoothModePrivateData *pd = op->pd;
+    DBusError err;
+    b32 failed = false;
+
+    // the mode was destroyed while the call was in flight
+    if (pd == NULL) {
+        operation_free(op);
+        return;
+    }
+
+    g_hash_table_steal(pd->operations, op->proxy);
+
+    dbus_error_init(&err);
+    if (dbus_set_error_from_message(&err, message)) {
+        g_debug("%s failed: %s", operation_strings[op->op][0], err.message);
+        dbus_error_free(&err);
+        failed = true;
+        if (op->op == OPERATION_DISCONNECT)
+            reconnect_forget(pd, op->proxy);
     }
-}
 
-internal void proxy_added(GDBusProxy *proxy, void *user_data) {
-    const char *interface;
-    Mode *sw = (Mode *)user_data;
-    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    if (op->batch) {
+        op->batch->failed += failed;
+        if (op->batch->outstanding == 1)
+            operation_batch_done(pd, op->batch);
+    } else {
+        u32 dev_index = find_device(op->proxy, pd->devices, pd->num_devices);
+        const char *name = dev_index != pd->num_devices ? pd->devices[dev_index].name : "device";
+
+        g_free(pd->command_status);
+        if (failed)
+            pd->command_status = g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s %s\n",
+                                                 operation_strings[op->op][1], name);
+        else
+            pd->command_status = g_strdup_printf("<span foreground=\"green\" weight=\"bold\">Success:</span> %s %s in %.2fs\n",
+                                                 operation_strings[op->op][3], name,
+                                                 (g_get_monotonic_time() - op->start) / 1e6);
+    }
 
-    interface = g_dbus_proxy_get_interface(proxy);
-    if (!strcmp(interface, "org.bluez.Device1")) {
-        if (pd->size_devices <= pd->num_devices) {
-            pd->size_devices *= 2;
-            pd->devices = g_realloc(pd->devices, sizeof(Device) * pd->size_devices);
-        }
-        Device *dev = &pd->devices[pd->num_devices];
-        dev->remote_proxy = proxy;
-        get_property(proxy, "Address", &dev->address);
-        get_property(proxy, "Alias", &dev->name);
-        get_property(proxy, "Connected", &dev->connected);
-        get_property(proxy, "Paired", &dev->paired);
-        get_property(proxy, "Trusted", &dev->trusted);
+    u32 dev_index = find_device(op->proxy, pd->devices, pd->num_devices);
+    if (dev_index != pd->num_devices)
+        update_device_row(pd, dev_index);
 
-        debug_print_device(dev);
-        pd->num_devices++;
-        if (dev->paired)
-            pd->num_paired_devices++;
-        update_entries(pd);
-        rofi_view_reload();
+    operation_free(op);
+    reload_view();
+}
 
-        if (pd->state == PAIR) {
-            // triggGer redraw
-        }
-    } else if (!strcmp(interface, "org.bluez.Adapter1")) {
-        if (!pd->controller) {
-            b32 b = true;
-            pd->controller = g_malloc0(sizeof(Controller));
-            pd->controller->remote_proxy = proxy;
-            g_dbus_proxy_set_property_basic(proxy, "Pairable", DBUS_TYPE_BOOLEAN, &b, NULL, NULL, NULL);
-            get_property(proxy, "Powered", &pd->controller->powered);
-            get_property(proxy, "Discoverable", &pd->controller->discoverable);
-            get_property(proxy, "Discovering", &pd->controller->discovering);
+// Returns false if the call could not be sent; an operation of either kind
+// already in flight for the device counts as started.
+internal b32 operation_start(BluetoothModePrivateData *pd, u32 dev_index, u32 type, OperationBatch *batch) {
+    Device *dev = &pd->devices[dev_index];
+
+    if (g_hash_table_contains(pd->operations, dev->remote_proxy))
+        return true;
+    if (type == OPERATION_DISCONNECT)
+        reconnect_cancel(pd, dev->remote_proxy);
+
+    Operation *op = g_malloc0(sizeof(Operation));
+    op->pd = pd;
+    op->proxy = g_dbus_proxy_ref(dev->remote_proxy);
+    op->op = type;
+    op->start = g_get_monotonic_time();
+    op->batch = batch;
+
+    if (g_dbus_proxy_method_call(dev->remote_proxy, operation_strings[type][0], NULL, operation_callback, op, NULL) ==
+        false) {
+        g_dbus_proxy_unref(op->proxy);
+        g_free(op);
+        return false;
+    }
 
-            debug_print_controller(pd->controller);
-            update_entries(pd);
-            rofi_view_reload();
-        }
+    if (batch) {
+        batch->outstanding++;
+        batch->total++;
     }
+    g_hash_table_insert(pd->operations, op->proxy, op);
+    update_device_row(pd, dev_index);
+    return true;
 }
 
-inline internal u32 find_device(GDBusProxy *proxy, Device *devices, u32 num_devices) {
+internal b32 device_is_audio(Device *dev) {
+    return dev->icon && g_str_has_prefix(dev->icon, "audio-");
+}
 
-    u32 i = 0;
-    for (; i < num_devices; i++) {
-        if (devices[i].remote_proxy == proxy)
-            break;
+internal void operation_start_all(BluetoothModePrivateData *pd, u32 type) {
+    OperationBatch *batch = g_malloc0(sizeof(OperationBatch));
+    batch->op = type;
+    batch->start = g_get_monotonic_time();
+
+    for (u32 i = 0; i < pd->num_devices; i++) {
+        Device *dev = &pd->devices[i];
+        if (!dev->paired || dev->remote_proxy == NULL)
+            continue;
+        if (type == OPERATION_CONNECT && (dev->connected || !device_is_audio(dev)))
+            continue;
+        if (type == OPERATION_DISCONNECT && !dev->connected)
+            continue;
+        if (!operation_start(pd, i, type, batch))
+            batch->failed++, batch->total++;
     }
 
-    return i;
+    if (batch->outstanding == 0) {
+        if (batch->total)
+            operation_batch_done(pd, batch);
+        else {
+            g_free(pd->command_status);
+            pd->command_status = g_strdup_printf("Nothing to %s\n", operation_strings[type][1]);
+        }
+        g_free(batch);
+    } else {
+        g_free(pd->command_status);
+        pd->command_status = g_strdup_printf("<b>%s %u devices</b>\n", operation_strings[type][2], batch->outstanding);
+    }
 }
 
 internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageIter *iter, void *user_data) {
@@ -217,55 +1561,91 @@ internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageI
     if (!strcmp(interface, "org.bluez.Device1")) {
 
         g_debug("property_name_changed: %s", name);
+        if (pd->discovery.active)
+            pd->discovery.signals++;
         u32 dev_index = find_device(proxy, pd->devices, pd->num_devices);
-        if (dev_index != pd->num_devices) {
-            Device *dev = &pd->devices[dev_index];
-            b32 update = false;
-            // @Robustness @Slowness, when is "ServicesResolved" actually called, it could be
-            // for more than connected. If so, we want to make sure that we only
-            // really test for all this stuff when we need to
-            if (!strcmp(name, "Connected") || !strcmp(name, "ServicesResolved")) {
-                dbus_message_iter_get_basic(iter, &dev->connected);
-                if (pd->state == DEVICE && pd->current_device == dev_index) {
-                    g_debug("detect connect change and queue update");
-                    g_debug("command_status: %s", pd->command_status);
-                    Entry *entry = &pd->entries[0];
-                    entry->text = device_strings[0][dev->connected];
-                    update = true;
-                } else if (pd->state == LIST) {
-                    for (u32 i = 0; i < pd->num_entries; i++) {
-                        Entry *entry = &pd->entries[i];
-                        if (entry->device == dev_index) {
-                            g_free(entry->text);
-                            entry->text = g_strdup_printf("%-20s%-10s", dev->name, true_false_array[dev->connected]);
-                            break;
-                        }
-                    }
-                    update = true;
-                }
-            } else if (!strcmp(name, "Paired")) {
-                dbus_message_iter_get_basic(iter, &dev->paired);
-                pd->num_paired_devices += 2 * dev->paired - 1;
+        // an evicted device is back in range; the proxy cache already holds
+        // this change, so device_add has applied it and there is nothing
+        // left to do per property
+        if (dev_index == pd->num_devices) {
+            device_add(pd, proxy);
+            eviction_enforce_cap(pd);
+            update_entries(pd);
+            reload_view();
+            return;
+        }
+        Device *dev = &pd->devices[dev_index];
+        b32 update = false;
+        dev->last_seen = g_get_monotonic_time();
+        // @Robustness @Slowness, when is "ServicesResolved" actually called, it could be
+        // for more than connected. If so, we want to make sure that we only
+        // really test for all this stuff when we need to
+        if (!strcmp(name, "Connected") || !strcmp(name, "ServicesResolved")) {
+            b32 was_connected = dev->connected;
+            dbus_message_iter_get_basic(iter, &dev->connected);
+            if (!strcmp(name, "Connected"))
+                reconnect_connected_changed(pd, dev, was_connected);
+            if (pd->state == DEVICE && pd->current_device == dev_index && dev->paired) {
+                g_debug("detect connect change and queue update");
+                g_debug("command_status: %s", pd->command_status);
+                Entry *entry = &pd->entries[0];
+                entry->text = device_strings[0][dev->connected];
+                update = true;
+            } else if (pd->state == LIST) {
+                update_device_row(pd, dev_index);
                 update = true;
+            }
+        } else if (!strcmp(name, "Paired")) {
+            dbus_message_iter_get_basic(iter, &dev->paired);
+            pd->num_paired_devices += 2 * dev->paired - 1;
+            if (dev->paired)
+                pair_order_remove(pd, dev_index);
+            else
+                pair_order_insert(pd, dev_index);
+            update = true;
+            update_entries(pd);
+        } else if (!strcmp(name, "RSSI")) {
+            dbus_int16_t rssi = 0;
+            if (iter)
+                dbus_message_iter_get_basic(iter, &rssi);
+            update = pair_order_update_rssi(pd, dev_index, iter != NULL, rssi) && pd->state == PAIR;
+        } else if (!strcmp(name, "Icon")) {
+            // iter points into the signal; the proxy's cache outlives it
+            dev->icon = NULL;
+            get_property(proxy, "Icon", &dev->icon);
+        } else if (!strcmp(name, "Alias")) {
+            get_property(proxy, "Alias", &dev->name);
+            if (pd->state == LIST) {
+                update_device_row(pd, dev_index);
+                update = true;
+            } else if (pd->state == PAIR) {
                 update_entries(pd);
-            } else if (!strcmp(name, "Trusted")) {
-                dbus_message_iter_get_basic(iter, &dev->trusted);
-                if (pd->state == DEVICE && pd->current_device == dev_index) {
-                    Entry *entry = &pd->entries[2];
-                    entry->text = device_strings[2][dev->trusted];
-                    update = true;
-                }
+                update = true;
+            }
+        } else if (!strcmp(name, "Trusted")) {
+            dbus_message_iter_get_basic(iter, &dev->trusted);
+            if (pd->state == DEVICE && pd->current_device == dev_index && dev->paired) {
+                Entry *entry = &pd->entries[2];
+                entry->text = device_strings[2][dev->trusted];
+                update = true;
             }
-            debug_print_device(dev);
-            if (update)
-                rofi_view_reload();
         }
+        debug_print_device(dev);
+        pipeline_property_changed(pd, proxy, name, iter);
+        if (update)
+            reload_view();
     } else if (!strcmp(interface, "org.bluez.Adapter1")) {
-        if (pd->controller->remote_proxy == proxy) {
+        Controller *controller = find_controller(pd, proxy);
+        if (controller) {
             u32 i = 0;
             b32 update = false;
-            b32 *controller_info = &pd->controller->powered;
+            b32 *controller_info = &controller->powered;
             g_debug("property_name_changed: %s", name);
+            if (!strcmp(name, "Alias")) {
+                // iter points into the signal; the proxy's cache outlives it
+                get_property(proxy, "Alias", &controller->name);
+                update = true;
+            }
             for (; i < 3; i++) {
                 if (!strcmp(name, controller_props[i])) {
                     dbus_message_iter_get_basic(iter, &(controller_info[i]));
@@ -273,18 +1653,29 @@ internal void property_changed(GDBusProxy *proxy, const char *name, DBusMessageI
                     break;
                 }
             }
-            if (i == 2 && pd->controller->discovering) {
-                pd->state = PAIR;
-                sw->display_name = "Pair:";
-                update_entries(pd);
-            } else if (update && pd->state == LIST) {
-                Entry *entry = &pd->entries[pd->num_paired_devices + i + 1];
-                g_free(entry->text);
-                entry->text = g_strdup_printf("%s: %s", name, true_false_array[controller_info[i]]);
+            // only the selected adapter has rows to touch
+            if (controller != pd->controller) {
+                debug_print_controller(controller);
+                return;
+            }
+            // entering PAIR is left to ENTRY_SCAN: Discovering also flips on
+            // every duty cycle and while an agent prompt is up
+            if (update && pd->state == LIST) {
+                for (u32 e = 0; e < pd->num_entries; e++) {
+                    Entry *entry = &pd->entries[e];
+                    u32 flags = entry->flags & ~ENTRY_ALLOCATED;
+                    b32 prop_row = flags == ENTRY_CONTROLLER_PROP || flags == ENTRY_SCAN;
+                    if (i < 3 && prop_row && entry->controller_prop == i) {
+                        replace_entry_text(entry,
+                                           g_strdup_printf("%s: %s", name, true_false_array[controller_info[i]]));
+                    } else if (i == 3 && flags == ENTRY_ADAPTER) {
+                        replace_entry_text(entry, g_strdup_printf("Adapter: %s", controller->name));
+                    }
+                }
             }
 
-            rofi_view_reload();
-            debug_print_controller(pd->controller);
+            reload_view();
+            debug_print_controller(controller);
         }
     }
 }
@@ -298,28 +1689,309 @@ internal void proxy_removed(GDBusProxy *proxy, void *user_data) {
     if (!strcmp(interface, "org.bluez.Device1")) {
 
         u32 dev_index = find_device(proxy, pd->devices, pd->num_devices);
+        reconnect_forget(pd, proxy);
 
         bool update = false;
         if (dev_index != pd->num_devices) {
-            if (pd->devices[dev_index].paired) {
-                pd->num_paired_devices--;
+            // device_unlink may move current_device onto dev_index
+            b32 was_current = pd->current_device == dev_index;
+            if (pd->devices[dev_index].paired)
                 update = (pd->state == LIST);
-            } else {
+            else
                 update = (pd->state == PAIR);
+            device_unlink(pd, dev_index);
+            if (pd->state == DEVICE && was_current) {
+                pd->state = LIST;
+                update = true;
             }
-            // TODO(rahul): we can just do a memcpy here / unordered remove
-            // unordered remove
-            pd->devices[dev_index] = pd->devices[--pd->num_devices];
-        }
-        if (pd->state == DEVICE && pd->current_device == dev_index) {
-            pd->state = LIST;
-            update = true;
+            if (pd->agent.return_state == DEVICE && was_current)
+                pd->agent.return_state = LIST;
         }
         if (update) {
             update_entries(pd);
-            rofi_view_reload();
+            reload_view();
+        }
+    } else if (!strcmp(interface, "org.bluez.Adapter1")) {
+        Controller *controller = find_controller(pd, proxy);
+        if (controller) {
+            g_hash_table_remove(pd->controllers, controller->path);
+            if (pd->controller == controller) {
+                // its proxy is gone, so there is nothing left to stop
+                discovery_session_end(pd);
+                pd->controller = NULL;
+                pd->controller = next_controller(pd);
+                if (pd->state != LIST && pd->state != AGENT)
+                    pd->state = LIST;
+            }
+            update_entries(pd);
+            reload_view();
+        }
+    } else if (!strcmp(interface, AGENT_MANAGER_INTERFACE)) {
+        pd->agent_manager = NULL;
+        pd->agent_registered = false;
+    }
+}
+
+/** AGENT **/
+
+internal const char *state_display_name(BluetoothModePrivateData *pd, u32 state) {
+    switch (state) {
+    case DEVICE:
+        return pd->devices[pd->current_device].name;
+    case PAIR:
+        return "Pair Device:";
+    case AGENT:
+        return "Agent:";
+    default:
+        return "Device:";
+    }
+}
+
+internal char *agent_device_name(BluetoothModePrivateData *pd, const char *path) {
+    for (u32 i = 0; i < pd->num_devices; i++) {
+        if (!strcmp(pd->devices[i].path, path))
+            return g_strdup(pd->devices[i].name);
+    }
+    return g_strdup(path);
+}
+
+internal void agent_finish(Mode *sw) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    AgentRequest *agent = &pd->agent;
+
+    dbus_message_unref(agent->message);
+    g_free(agent->device_name);
+    agent->message = NULL;
+    agent->device_name = NULL;
+    agent->request = AGENT_REQUEST_NONE;
+
+    pd->state = agent->return_state;
+    sw->display_name = state_display_name(pd, pd->state);
+    update_entries(pd);
+    reload_view();
+}
+
+internal void agent_reject(Mode *sw, const char *error) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    if (pd->agent.message == NULL)
+        return;
+    g_dbus_send_error(pd->dbus_conn, pd->agent.message, error, NULL);
+    agent_finish(sw);
+}
+
+internal void agent_accept(Mode *sw) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    if (pd->agent.message == NULL)
+        return;
+    g_dbus_send_reply(pd->dbus_conn, pd->agent.message, DBUS_TYPE_INVALID);
+    agent_finish(sw);
+}
+
+internal void agent_reply_input(Mode *sw, const char *input) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    AgentRequest *agent = &pd->agent;
+
+    if (agent->request == AGENT_REQUEST_PASSKEY) {
+        char *end;
+        u64 passkey = g_ascii_strtoull(input, &end, 10);
+        if (*input == '\0' || *end != '\0' || passkey > 999999) {
+            g_free(pd->command_status);
+            pd->command_status =
+                g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Passkey must be 0-999999\n");
+            return;
+        }
+        dbus_uint32_t value = passkey;
+        g_dbus_send_reply(pd->dbus_conn, agent->message, DBUS_TYPE_UINT32, &value, DBUS_TYPE_INVALID);
+    } else if (agent->request == AGENT_REQUEST_PIN_CODE) {
+        u64 len = strlen(input);
+        if (len < 1 || len > 16) {
+            g_free(pd->command_status);
+            pd->command_status =
+                g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> PIN must be 1-16 characters\n");
+            return;
         }
+        g_dbus_send_reply(pd->dbus_conn, agent->message, DBUS_TYPE_STRING, &input, DBUS_TYPE_INVALID);
+    } else
+        return;
+
+    agent_finish(sw);
+}
+
+internal DBusMessage *agent_begin(Mode *sw, DBusMessage *message, u32 request, u32 passkey) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    AgentRequest *agent = &pd->agent;
+    const char *path;
+
+    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_INVALID))
+        return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS, NULL);
+
+    // BlueZ only has one request outstanding per agent, but be safe
+    if (agent->message) {
+        g_dbus_send_error(pd->dbus_conn, agent->message, AGENT_ERROR_CANCELED, NULL);
+        dbus_message_unref(agent->message);
+        g_free(agent->device_name);
+    } else
+        agent->return_state = pd->state;
+
+    agent->message = dbus_message_ref(message);
+    agent->request = request;
+    agent->passkey = passkey;
+    agent->device_name = agent_device_name(pd, path);
+
+    pd->state = AGENT;
+    sw->display_name = state_display_name(pd, AGENT);
+    update_entries(pd);
+    reload_view();
+
+    return NULL;
+}
+
+internal DBusMessage *agent_release(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    Mode *sw = user_data;
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    pd->agent_registered = false;
+    agent_reject(sw, AGENT_ERROR_CANCELED);
+
+    return dbus_message_new_method_return(message);
+}
+
+internal DBusMessage *agent_request_pin_code(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    return agent_begin(user_data, message, AGENT_REQUEST_PIN_CODE, 0);
+}
+
+internal DBusMessage *agent_request_passkey(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    return agent_begin(user_data, message, AGENT_REQUEST_PASSKEY, 0);
+}
+
+internal DBusMessage *agent_request_confirmation(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    const char *path;
+    dbus_uint32_t passkey;
+
+    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_UINT32, &passkey,
+                               DBUS_TYPE_INVALID))
+        return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS, NULL);
+
+    return agent_begin(user_data, message, AGENT_REQUEST_CONFIRMATION, passkey);
+}
+
+internal DBusMessage *agent_request_authorization(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    return agent_begin(user_data, message, AGENT_REQUEST_AUTHORIZATION, 0);
+}
+
+internal DBusMessage *agent_authorize_service(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    Mode *sw = user_data;
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    const char *path, *uuid;
+
+    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_STRING, &uuid,
+                               DBUS_TYPE_INVALID))
+        return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS, NULL);
+
+    // services on devices we have already paired with don't need asking about
+    for (u32 i = 0; i < pd->num_devices; i++) {
+        Device *dev = &pd->devices[i];
+        if (dev->paired && !strcmp(dev->path, path))
+            return dbus_message_new_method_return(message);
     }
+
+    return agent_begin(sw, message, AGENT_REQUEST_AUTHORIZATION, 0);
+}
+
+internal void agent_display(Mode *sw, const char *path, const char *code) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    char *name = agent_device_name(pd, path);
+
+    g_free(pd->command_status);
+    pd->command_status = g_strdup_printf("<b>Enter on %s:</b> %s\n", name, code);
+    g_free(name);
+    reload_view();
+}
+
+internal DBusMessage *agent_display_pin_code(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    const char *path, *pin_code;
+
+    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_STRING, &pin_code,
+                               DBUS_TYPE_INVALID))
+        return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS, NULL);
+
+    agent_display(user_data, path, pin_code);
+    return dbus_message_new_method_return(message);
+}
+
+internal DBusMessage *agent_display_passkey(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    const char *path;
+    dbus_uint32_t passkey;
+    dbus_uint16_t entered;
+
+    if (!dbus_message_get_args(message, NULL, DBUS_TYPE_OBJECT_PATH, &path, DBUS_TYPE_UINT32, &passkey,
+                               DBUS_TYPE_UINT16, &entered, DBUS_TYPE_INVALID))
+        return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS, NULL);
+
+    char code[8];
+    snprintf(code, sizeof(code), "%06u", passkey);
+    agent_display(user_data, path, code);
+    return dbus_message_new_method_return(message);
+}
+
+internal DBusMessage *agent_cancel(DBusConnection *conn, DBusMessage *message, void *user_data) {
+    Mode *sw = user_data;
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+
+    // BlueZ has given up on the request, so there is nobody left to reply to
+    if (pd->agent.message)
+        agent_finish(sw);
+
+    return dbus_message_new_method_return(message);
+}
+
+global_variable const GDBusMethodTable agent_methods[] = {
+    {GDBUS_METHOD("Release", NULL, NULL, agent_release)},
+    {GDBUS_ASYNC_METHOD("RequestPinCode", GDBUS_ARGS({"device", "o"}), GDBUS_ARGS({"pincode", "s"}),
+                        agent_request_pin_code)},
+    {GDBUS_METHOD("DisplayPinCode", GDBUS_ARGS({"device", "o"}, {"pincode", "s"}), NULL, agent_display_pin_code)},
+    {GDBUS_ASYNC_METHOD("RequestPasskey", GDBUS_ARGS({"device", "o"}), GDBUS_ARGS({"passkey", "u"}),
+                        agent_request_passkey)},
+    {GDBUS_METHOD("DisplayPasskey", GDBUS_ARGS({"device", "o"}, {"passkey", "u"}, {"entered", "q"}), NULL,
+                  agent_display_passkey)},
+    {GDBUS_ASYNC_METHOD("RequestConfirmation", GDBUS_ARGS({"device", "o"}, {"passkey", "u"}), NULL,
+                        agent_request_confirmation)},
+    {GDBUS_ASYNC_METHOD("RequestAuthorization", GDBUS_ARGS({"device", "o"}), NULL, agent_request_authorization)},
+    {GDBUS_ASYNC_METHOD("AuthorizeService", GDBUS_ARGS({"device", "o"}, {"uuid", "s"}), NULL,
+                        agent_authorize_service)},
+    {GDBUS_METHOD("Cancel", NULL, NULL, agent_cancel)},
+    {}};
+
+// Everything but the bus: the fuzz harness (fuzz/) hands in its own
+// connection and client.
+internal void bluetooth_mode_init_state(Mode *sw, BluetoothModePrivateData *pd) {
+    g_dbus_client_set_proxy_handlers(pd->client, proxy_added, proxy_removed, property_changed, sw);
+    g_dbus_client_set_ready_watch(pd->client, client_ready, sw);
+
+    pd->num_devices = 0;
+    pd->num_paired_devices = 0;
+    pd->devices = g_malloc0(sizeof(Device));
+    pd->size_devices = 1;
+    memstat_add(MEMSTAT_DEVICE, sizeof(Device), 0);
+    pd->state = LIST;
+
+    pd->current_device = 0;
+
+    sw->display_name = "Device:";
+
+    pd->num_entries = 0;
+    pd->entries = g_malloc0(sizeof(Entry));
+    pd->size_entries = 1;
+    memstat_add(MEMSTAT_ENTRY, sizeof(Entry), 0);
+
+    pd->operations = g_hash_table_new(g_direct_hash, g_direct_equal);
+    pd->controllers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    reconnect_init(&pd->reconnect);
+    discovery_filter_init(&pd->filter);
+    discovery_session_init(&pd->discovery);
+    eviction_init(pd);
 }
 
 internal int bluetooth_mode_init(Mode *sw) {
@@ -329,25 +2001,19 @@ internal int bluetooth_mode_init(Mode *sw) {
 
         pd->dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
         g_dbus_attach_object_manager(pd->dbus_conn);
+        g_dbus_register_interface(pd->dbus_conn, AGENT_PATH, AGENT_INTERFACE, agent_methods, NULL, NULL, sw, NULL);
 
         pd->client = g_dbus_client_new(pd->dbus_conn, "org.bluez", "/org/bluez");
-        g_dbus_client_set_proxy_handlers(pd->client, proxy_added, proxy_removed, property_changed, sw);
-
-        generic_callback_data.pd = pd;
-
-        pd->num_devices = 0;
-        pd->num_paired_devices = 0;
-        pd->devices = g_malloc0(sizeof(Device));
-        pd->size_devices = 1;
-        pd->state = LIST;
 
-        pd->current_device = 0;
-
-        sw->display_name = "Device:";
+        char *record_path = NULL;
+        if (find_arg_str("-bluetooth-record", &record_path)) {
+            pd->recorder = recorder_open(record_path);
+            if (pd->recorder)
+                g_dbus_client_set_record_watch(pd->client, recorder_message, pd->recorder);
+        }
 
-        pd->num_entries = 0;
-        pd->entries = g_malloc0(sizeof(Entry));
-        pd->size_entries = 1;
+        bluetooth_mode_init_state(sw, pd);
+        snapshot_load(pd);
     }
     return true;
 }
@@ -356,73 +2022,135 @@ internal unsigned int bluetooth_mode_get_num_entries(const Mode *sw) {
     return pd->num_entries;
 }
 
-/** CALLBACKS **/
+/** REQUESTS **/
 
-internal void generic_callback(const DBusError *error, void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    BluetoothModePrivateData *pd = data->pd;
-    char *str = data->data;
+// The pool outlives any one mode instance: a request still in flight when the
+// mode is destroyed is detached and returns here once its reply arrives.
+global_variable Request request_pool[REQUEST_POOL_SIZE];
+global_variable Request *request_free_list = NULL;
+global_variable b32 request_pool_ready = false;
 
-    g_free(pd->command_status);
-    if (dbus_error_is_set(error)) {
-        pd->command_status =
-            g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to set %s\n", str);
+internal Request *request_new(BluetoothModePrivateData *pd) {
+    Request *req;
+
+    if (!request_pool_ready) {
+        for (u32 i = 0; i < REQUEST_POOL_SIZE; i++) {
+            request_pool[i].pooled = true;
+            request_pool[i].next = request_free_list;
+            request_free_list = &request_pool[i];
+        }
+        request_pool_ready = true;
+    }
+
+    if (request_free_list) {
+        req = request_free_list;
+        request_free_list = req->next;
     } else {
-        pd->command_status =
-            g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> Changed %s\n", str);
+        req = g_malloc0(sizeof(Request));
+    }
+
+    req->pd = pd;
+    req->prev = NULL;
+    req->next = pd->requests;
+    if (pd->requests)
+        pd->requests->prev = req;
+    pd->requests = req;
+
+    req->flag = false;
+    req->start = g_get_monotonic_time();
+    req->end = 0;
+    req->label[0] = '\0';
+    return req;
+}
+
+// Destroy function for every request; also called directly when a call
+// could not be sent.
+internal void request_release(void *user_data) {
+    Request *req = user_data;
+
+    if (req->pd) {
+        if (req->prev)
+            req->prev->next = req->next;
+        else
+            req->pd->requests = req->next;
+        if (req->next)
+            req->next->prev = req->prev;
+        req->pd = NULL;
     }
+
+    if (!req->pooled) {
+        g_free(req);
+        return;
+    }
+    req->prev = NULL;
+    req->next = request_free_list;
+    request_free_list = req;
+}
+
+internal f64 request_finish(Request *req) {
+    req->end = g_get_monotonic_time();
+    return (req->end - req->start) / 1e6;
 }
 
-internal void connect_callback(DBusMessage *message, void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    BluetoothModePrivateData *pd = data->pd;
-    b32 connected = GPOINTER_TO_UINT(data->data);
+/** CALLBACKS **/
 
-    g_debug("connected: %s", TF(connected));
+internal void generic_callback(const DBusError *error, void *user_data) {
+    Request *req = user_data;
+    BluetoothModePrivateData *pd = req->pd;
+    f64 elapsed = request_finish(req);
 
-    DBusError err;
+    if (pd == NULL)
+        return;
 
     g_free(pd->command_status);
-    dbus_error_init(&err);
-    if (dbus_set_error_from_message(&err, message)) {
-        pd->command_status = g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s\n",
-                                             (connected) ? "disconnect" : "connect");
-        dbus_error_free(&err);
+    if (dbus_error_is_set(error)) {
+        pd->command_status =
+            g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to set %s\n", req->label);
+    } else {
+        pd->command_status = g_strdup_printf(
+            "<span foreground =\"green\" weight=\"bold\">Success:</span> Changed %s in %.2fs\n", req->label, elapsed);
     }
-    pd->command_status = g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> %s\n",
-                                         (connected) ? "Disconnected" : "Connected");
-    g_debug("command_status: %s", pd->command_status);
 }
 
 internal void pair_callback(DBusMessage *message, void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    BluetoothModePrivateData *pd = data->pd;
+    Request *req = user_data;
+    BluetoothModePrivateData *pd = req->pd;
+    f64 elapsed = request_finish(req);
 
     DBusError err;
 
+    if (pd == NULL)
+        return;
+
     g_free(pd->command_status);
 
     dbus_error_init(&err);
     if (dbus_set_error_from_message(&err, message)) {
         pd->command_status = g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to pair\n");
         dbus_error_free(&err);
+    } else {
+        pd->command_status =
+            g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> Paired in %.2fs\n", elapsed);
     }
-    pd->command_status = g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> Paired\n");
 }
 
 internal void remove_device_setup(DBusMessageIter *iter, void *user_data) {
-    struct GenericCallbackData *data = user_data;
+    Request *req = user_data;
 
-    const char *path = data->data;
+    const char *path = req->label;
     dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
 }
 
 internal void remove_callback(DBusMessage *message, void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    BluetoothModePrivateData *pd = data->pd;
+    Request *req = user_data;
+    BluetoothModePrivateData *pd = req->pd;
+    f64 elapsed = request_finish(req);
 
     DBusError err;
 
+    if (pd == NULL)
+        return;
+
     g_free(pd->command_status);
 
     dbus_error_init(&err);
@@ -430,26 +2158,37 @@ internal void remove_callback(DBusMessage *message, void *user_data) {
         pd->command_status =
             g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to remove\n");
         dbus_error_free(&err);
+    } else {
+        pd->command_status =
+            g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> Removed in %.2fs\n", elapsed);
     }
-    pd->command_status = g_strdup_printf("<span foreground =\"green\" weight=\"bold\">Success:</span> Removed\n");
 }
 
 internal void scan_callback(DBusMessage *message, void *user_data) {
-    struct GenericCallbackData *data = user_data;
-    BluetoothModePrivateData *pd = data->pd;
-    b32 scan = GPOINTER_TO_UINT(data->data);
+    Request *req = user_data;
+    BluetoothModePrivateData *pd = req->pd;
+    b32 scan = req->flag;
+    f64 elapsed = request_finish(req);
 
     DBusError err;
 
+    if (pd == NULL)
+        return;
+
+    g_free(pd->command_status);
+
     dbus_error_init(&err);
     if (dbus_set_error_from_message(&err, message)) {
         pd->command_status = g_strdup_printf(
             "<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s discovery\n", scan ? "Stop" : "Start");
         dbus_error_free(&err);
+        if (!scan)
+            discovery_session_end(pd);
+    } else {
+        pd->command_status = g_strdup_printf(
+            "<span foreground=\"green\" weight=\"bold\">Success:</span> %s discovery in %.2fs\n",
+            scan ? "stopped" : "started", elapsed);
     }
-
-    pd->command_status = g_strdup_printf("<span foreground=\"green\" weight=\"bold\">Success:</span> %s discovery\n",
-                                         scan ? "stopped" : "started");
 }
 
 void switch_state(Mode *sw, const u32 next_state, const char *next_display_name) {
@@ -468,15 +2207,36 @@ internal ModeMode bluetooth_mode_result(Mode *sw, int mretv, char **input, unsig
 
     Entry *entry = &pd->entries[selected_line];
 
-    if (mretv & MENU_OK) {
+    if ((mretv & MENU_CUSTOM_INPUT) && pd->state == AGENT) {
+        agent_reply_input(sw, *input);
+    } else if (mretv & MENU_OK) {
         switch (entry->flags & ~ENTRY_ALLOCATED) {
+        case ENTRY_DEVICE_PAIR_CONNECT:
+            pipeline_start(pd, &pd->devices[entry->device]);
+            break;
+        case ENTRY_AGENT_ACCEPT:
+            agent_accept(sw);
+            break;
+        case ENTRY_AGENT_REJECT:
+            agent_reject(sw, AGENT_ERROR_REJECTED);
+            break;
         case ENTRY_MENU_LIST:
             switch_state(sw, LIST, "Device:");
             break;
+        case ENTRY_ADAPTER:
+            discovery_session_stop(pd);
+            pd->controller = next_controller(pd);
+            update_entries(pd);
+            break;
         case ENTRY_MENU_PAIR:
             switch_state(sw, PAIR, "Pair Device:");
             break;
         case ENTRY_DEVICE:
+            if (pd->devices[entry->device].remote_proxy == NULL) {
+                g_free(pd->command_status);
+                pd->command_status = g_strdup_printf("<i>Still loading devices...</i>\n");
+                break;
+            }
             pd->current_device = entry->device;
             switch_state(sw, DEVICE, pd->devices[pd->current_device].name);
             break;
@@ -486,41 +2246,53 @@ internal ModeMode bluetooth_mode_result(Mode *sw, int mretv, char **input, unsig
             const char *prop_name = device_props[entry->controller_prop >> 1];
             prop = !(&dev->connected)[entry->device_prop];
 
-            generic_callback_data.data = g_strdup_printf("[%s] to %s", prop_name, true_false_array[prop]);
+            Request *req = request_new(pd);
+            g_snprintf(req->label, sizeof(req->label), "[%s] to %s", prop_name, true_false_array[prop]);
             if (g_dbus_proxy_set_property_basic(dev->remote_proxy, prop_name, DBUS_TYPE_BOOLEAN, &prop,
-                                                generic_callback, &generic_callback_data,
-                                                free_generic_callback_data) == false)
-                g_free(generic_callback_data.data);
+                                                generic_callback, req, request_release) == false)
+                request_release(req);
         } break;
         case ENTRY_DEVICE_CONNECT: {
             Device *dev = &pd->devices[entry->device];
-            const char *method;
-
-            method = (dev->connected) ? "Disconnect" : "Connect";
-            generic_callback_data.data = GUINT_TO_POINTER(dev->connected);
+            u32 type = dev->connected ? OPERATION_DISCONNECT : OPERATION_CONNECT;
 
-            if (g_dbus_proxy_method_call(dev->remote_proxy, method, NULL, connect_callback, &generic_callback_data,
-                                         NULL) == false) {
+            if (operation_start(pd, entry->device, type, NULL) == false) {
                 g_free(pd->command_status);
-                pd->command_status =
-                    g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s\n",
-                                    (dev->connected) ? "disconnect" : "connect");
-            };
+                pd->command_status = g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> Failed to %s\n",
+                                                     operation_strings[type][1]);
+            }
         } break;
+        case ENTRY_CONNECT_AUDIO:
+            operation_start_all(pd, OPERATION_CONNECT);
+            break;
+        case ENTRY_DISCONNECT_ALL:
+            operation_start_all(pd, OPERATION_DISCONNECT);
+            break;
         case ENTRY_DEVICE_PAIR: {
             Device *dev = &pd->devices[entry->device];
-            const char *path = g_dbus_proxy_get_path(dev->remote_proxy);
-            generic_callback_data.data = g_strdup(path);
+            Request *req = request_new(pd);
 
             if (dev->paired) {
-                if (g_dbus_proxy_method_call(pd->controller->remote_proxy, "RemoveDevice", remove_device_setup,
-                                             remove_callback, &generic_callback_data,
-                                             free_generic_callback_data) == false) {
-                    g_free(generic_callback_data.data);
+                Controller *controller = device_controller(pd, dev);
+                if (controller == NULL) {
+                    // the device's adapter has not shown up (yet)
+                    request_release(req);
+                    g_free(pd->command_status);
+                    pd->command_status =
+                        g_strdup_printf("<span foreground=\"red\" weight=\"bold\">Error:</span> No adapter for %s\n",
+                                        dev->name);
+                    break;
+                }
+                g_strlcpy(req->label, dev->path, sizeof(req->label));
+                if (g_dbus_proxy_method_call(controller->remote_proxy, "RemoveDevice", remove_device_setup,
+                                             remove_callback, req, request_release) == false) {
+                    request_release(req);
                     retv = MODE_EXIT;
                 }
             } else {
-                g_dbus_proxy_method_call(dev->remote_proxy, "Pair", NULL, pair_callback, &generic_callback_data, NULL);
+                if (g_dbus_proxy_method_call(dev->remote_proxy, "Pair", NULL, pair_callback, req, request_release) ==
+                    false)
+                    request_release(req);
             }
         } break;
         case ENTRY_CONTROLLER_PROP: {
@@ -529,32 +2301,64 @@ internal ModeMode bluetooth_mode_result(Mode *sw, int mretv, char **input, unsig
             const char *prop_name = controller_props[entry->controller_prop];
             prop = !(&pd->controller->powered)[entry->controller_prop];
 
-            generic_callback_data.data = g_strdup_printf("[%s] to %s", prop_name, true_false_array[prop]);
+            Request *req = request_new(pd);
+            g_snprintf(req->label, sizeof(req->label), "[%s] to %s", prop_name, true_false_array[prop]);
             if (g_dbus_proxy_set_property_basic(pd->controller->remote_proxy, prop_name, DBUS_TYPE_BOOLEAN, &prop,
-                                                generic_callback, &generic_callback_data,
-                                                free_generic_callback_data) == false)
-                g_free(generic_callback_data.data);
+                                                generic_callback, req, request_release) == false)
+                request_release(req);
             break;
         }
         case ENTRY_SCAN: {
             const char *method;
-            if (!pd->controller->discovering) {
+            b32 scanning = pd->controller->discovering || pd->discovery.active;
+
+            // a duty cycled session in its off phase has nothing to stop
+            if (scanning && !pd->controller->discovering) {
+                discovery_session_end(pd);
+                g_free(pd->command_status);
+                pd->command_status =
+                    g_strdup_printf("<span foreground=\"green\" weight=\"bold\">Success:</span> stopped discovery\n");
+                break;
+            }
+
+            if (!scanning) {
                 method = "StartDiscovery";
+                // queued ahead of StartDiscovery on the same connection, so it
+                // is in effect before the first device is reported
+                discovery_filter_push(pd);
             } else
                 method = "StopDiscovery";
 
-            generic_callback_data.data = GUINT_TO_POINTER(pd->controller->discovering);
+            Request *req = request_new(pd);
+            req->flag = scanning;
 
-            g_dbus_proxy_method_call(pd->controller->remote_proxy, method, NULL, scan_callback, &generic_callback_data,
-                                     NULL);
+            if (g_dbus_proxy_method_call(pd->controller->remote_proxy, method, NULL, scan_callback, req,
+                                         request_release) == false) {
+                request_release(req);
+                break;
+            }
+            if (scanning) {
+                discovery_session_end(pd);
+            } else {
+                discovery_session_begin(pd);
+                switch_state(sw, PAIR, "Pair Device:");
+            }
         } break;
         }
     } else if (mretv & MENU_NEXT) {
         retv = NEXT_DIALOG;
     } else if (mretv & MENU_PREVIOUS) {
         retv = PREVIOUS_DIALOG;
+    } else if ((mretv & MENU_CANCEL) && pd->state == AGENT) {
+        // leaving would strand BlueZ until its agent call times out
+        agent_reject(sw, AGENT_ERROR_REJECTED);
     } else if (mretv & MENU_CANCEL) {
         retv = MODE_EXIT;
+    } else if ((mretv & MENU_CUSTOM_COMMAND) && (mretv & MENU_LOWER_MASK) == 0) {
+        // kb-custom-1 on a device in the pair list does the whole onboarding in one go
+        if (pd->state == PAIR && (entry->flags & ~ENTRY_ALLOCATED) == ENTRY_DEVICE &&
+            pd->devices[entry->device].remote_proxy)
+            pipeline_start(pd, &pd->devices[entry->device]);
     } else if (mretv & MENU_QUICK_SWITCH) {
         retv = (mretv & MENU_LOWER_MASK);
     } else if ((mretv & MENU_ENTRY_DELETE) == MENU_ENTRY_DELETE) {
@@ -571,10 +2375,54 @@ internal void bluetooth_mode_destroy(Mode *sw) {
     BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
     if (pd == NULL)
         return;
-    g_dbus_proxy_set_property_basic(pd->controller->remote_proxy, "Pairable", DBUS_TYPE_BOOLEAN, &pairable, NULL, NULL,
-                                    NULL);
+    memstat_dump(G_LOG_LEVEL_DEBUG);
+    GHashTableIter controllers;
+    Controller *controller;
+    g_hash_table_iter_init(&controllers, pd->controllers);
+    while (g_hash_table_iter_next(&controllers, NULL, (gpointer *)&controller))
+        g_dbus_proxy_set_property_basic(controller->remote_proxy, "Pairable", DBUS_TYPE_BOOLEAN, &pairable, NULL, NULL,
+                                        NULL);
+
+    if (pd->agent.message) {
+        g_dbus_send_error(pd->dbus_conn, pd->agent.message, AGENT_ERROR_CANCELED, NULL);
+        dbus_message_unref(pd->agent.message);
+        g_free(pd->agent.device_name);
+    }
+    if (pd->agent_registered)
+        g_dbus_proxy_method_call(pd->agent_manager, "UnregisterAgent", agent_path_setup, NULL, NULL, NULL);
+    g_dbus_unregister_interface(pd->dbus_conn, AGENT_PATH, AGENT_INTERFACE);
+
+    if (pd->pipeline) {
+        // outstanding replies free the pipeline once they arrive
+        pd->pipeline->pd = NULL;
+        if (pd->pipeline->outstanding == 0) {
+            g_dbus_proxy_unref(pd->pipeline->proxy);
+            g_free(pd->pipeline);
+        }
+        pd->pipeline = NULL;
+    }
+
+    // in-flight operations free themselves when their reply arrives
+    GHashTableIter iter;
+    Operation *op;
+    g_hash_table_iter_init(&iter, pd->operations);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&op))
+        op->pd = NULL;
+    g_hash_table_destroy(pd->operations);
+
+    reconnect_destroy(&pd->reconnect);
+    discovery_filter_destroy(&pd->filter);
+    discovery_session_destroy(pd);
+    eviction_destroy(pd);
+
+    // likewise for outstanding requests, which go back to the pool on reply
+    for (Request *req = pd->requests; req; req = req->next)
+        req->pd = NULL;
+    pd->requests = NULL;
 
-    generic_callback_data.pd = NULL;
+    // the client may outlive this unref while replies are pending
+    g_dbus_client_set_record_watch(pd->client, NULL, NULL);
+    recorder_close(pd->recorder);
 
     g_dbus_client_unref(pd->client);
     g_debug("freed client");
@@ -583,16 +2431,18 @@ internal void bluetooth_mode_destroy(Mode *sw) {
 
     mode_set_private_data(sw, NULL);
 
-    g_debug("freeing controller");
-    g_free(pd->controller);
+    g_debug("freeing controllers");
+    g_hash_table_destroy(pd->controllers);
     g_debug("freeing devices");
+    memstat_add(MEMSTAT_DEVICE, -(i64)(sizeof(Device) * pd->size_devices), -(i64)pd->num_devices);
     g_free(pd->devices);
+    g_free(pd->pair_order);
+    g_free(pd->snapshot);
 
     g_debug("freeing entries");
-    for (u32 i = 0; i < pd->num_entries; i++) {
-        if (pd->entries[i].flags & ENTRY_ALLOCATED)
-            g_free(pd->entries[i].text);
-    }
+    for (u32 i = 0; i < pd->num_entries; i++)
+        entry_free_text(&pd->entries[i]);
+    memstat_add(MEMSTAT_ENTRY, -(i64)(sizeof(Entry) * pd->size_entries), -(i64)pd->num_entries);
     g_free(pd->entries);
 
     g_debug("freeing private data");
@@ -632,10 +2482,19 @@ internal char *_get_message(const Mode *sw) {
     char *message = NULL;
 
     switch (pd->state) {
-    case LIST:
-        message =
-            g_strdup_printf("%s%s\n%-20s%-10s", command_status, "<b>Connect:</b> <i>Ctrl-C</i>", "Name", "Connected");
+    case LIST: {
+        ReconnectScheduler *sched = &pd->reconnect;
+        char *reconnect = NULL;
+        u32 num_reconnects = sched->enabled ? reconnect_num_pending(sched) : 0;
+        if (num_reconnects)
+            reconnect = g_strdup_printf("<i>Reconnecting %u device(s)</i>\n", num_reconnects);
+        char *scan = discovery_session_stats(pd);
+        message = g_strdup_printf("%s%s%s%s\n%-20s%-10s", command_status, reconnect ? reconnect : "",
+                                  scan ? scan : "", "<b>Connect:</b> <i>Ctrl-C</i>", "Name", "Connected");
+        g_free(reconnect);
+        g_free(scan);
         break;
+    }
     case DEVICE: {
         Device *dev = &pd->devices[pd->current_device];
         message = g_strdup_printf("%s%-20s%-10s%-10s%-10s\n%-20s%-10s%-10s%-10s", command_status, "ID", "Connected",
@@ -643,13 +2502,50 @@ internal char *_get_message(const Mode *sw) {
                                   true_false_array[dev->paired], true_false_array[dev->trusted]);
         break;
     }
-    case PAIR:
-        message = g_strdup_printf("%s<b>Pair: </b> <i>Ctrl-P</i>\n%-20s%-20s", command_status, "ID", "Name");
+    case PAIR: {
+        char *scan = discovery_session_stats(pd);
+        message = g_strdup_printf("%s%s<b>Pair: </b> <i>Ctrl-P</i>  <b>Pair and Connect: </b> <i>kb-custom-1</i>\n%-20s%-20s",
+                                  command_status, scan ? scan : "", "ID", "Name");
+        g_free(scan);
+        break;
+    }
+    case AGENT: {
+        AgentRequest *agent = &pd->agent;
+        switch (agent->request) {
+        case AGENT_REQUEST_CONFIRMATION:
+            message = g_strdup_printf("%s<b>Confirm passkey for %s:</b> %06u", command_status, agent->device_name,
+                                      agent->passkey);
+            break;
+        case AGENT_REQUEST_AUTHORIZATION:
+            message = g_strdup_printf("%s<b>Authorize %s?</b>", command_status, agent->device_name);
+            break;
+        case AGENT_REQUEST_PASSKEY:
+            message = g_strdup_printf("%s<b>Type passkey for %s</b>  <b>Reject: </b> <i>Escape</i>", command_status,
+                                      agent->device_name);
+            break;
+        case AGENT_REQUEST_PIN_CODE:
+            message = g_strdup_printf("%s<b>Type PIN code for %s</b>  <b>Reject: </b> <i>Escape</i>", command_status,
+                                      agent->device_name);
+            break;
+        }
         break;
     }
+    }
     return message;
 }
 
+// With -bluetooth-scan-prefix, a single word typed in the PAIR state is
+// pushed down to BlueZ as the discovery Pattern, so only devices whose
+// address or name starts with it are created while typing. Several words
+// have no prefix equivalent and leave the scan unfiltered.
+internal char *_preprocess_input(Mode *sw, const char *input) {
+    BluetoothModePrivateData *pd = (BluetoothModePrivateData *)mode_get_private_data(sw);
+    b32 prefix = pd->filter.prefix && pd->state == PAIR && !strpbrk(input, " \t");
+
+    discovery_filter_set_pattern(pd, prefix ? input : "");
+    return g_strdup(input);
+}
+
 Mode mode = {
     .abi_version = ABI_VERSION,
     .name = "bluetooth",
@@ -662,7 +2558,7 @@ Mode mode = {
     ._get_display_value = _get_display_value,
     ._get_message = _get_message,
     ._get_completion = NULL,
-    ._preprocess_input = NULL,
+    ._preprocess_input = _preprocess_input,
     .private_data = NULL,
     .free = NULL,
 };
@@ -19,6 +19,8 @@
 #include <dbus/dbus.h>
 
 #include "gdbus.h"
+#include "memstat.h"
+#include "probes.h"
 
 #define METHOD_CALL_TIMEOUT (300 * 1000)
 
@@ -45,6 +47,8 @@ struct GDBusClient {
 	void *disconn_data;
 	GDBusMessageFunction signal_func;
 	void *signal_data;
+	GDBusMessageFunction record_func;
+	void *record_data;
 	GDBusProxyFunction proxy_added;
 	GDBusProxyFunction proxy_removed;
 	GDBusClientFunction ready;
@@ -250,11 +254,48 @@ static void iter_append_iter(DBusMessageIter *base, DBusMessageIter *iter)
 	}
 }
 
+static gboolean prop_entry_equal(struct prop_entry *prop,
+						DBusMessageIter *iter)
+{
+	DBusMessageIter old;
+	DBusBasicValue a, b;
+	int type = dbus_message_iter_get_arg_type(iter);
+
+	if (prop->msg == NULL || !dbus_type_is_basic(type))
+		return FALSE;
+
+	if (!dbus_message_iter_init(prop->msg, &old) ||
+			dbus_message_iter_get_arg_type(&old) != type)
+		return FALSE;
+
+	/* Narrow types only fill the low bytes of the union */
+	memset(&a, 0, sizeof(a));
+	memset(&b, 0, sizeof(b));
+
+	dbus_message_iter_get_basic(&old, &a);
+	dbus_message_iter_get_basic(iter, &b);
+
+	switch (type) {
+	case DBUS_TYPE_STRING:
+	case DBUS_TYPE_OBJECT_PATH:
+	case DBUS_TYPE_SIGNATURE:
+		return g_strcmp0(a.str, b.str) == 0;
+	case DBUS_TYPE_UNIX_FD:
+		return FALSE;
+	default:
+		return a.u64 == b.u64;
+	}
+}
+
 static void prop_entry_update(struct prop_entry *prop, DBusMessageIter *iter)
 {
 	DBusMessage *msg;
 	DBusMessageIter base;
 
+	/* Refreshes and GetAll replies mostly repeat what is cached */
+	if (prop_entry_equal(prop, iter))
+		return;
+
 	msg = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_RETURN);
 	if (msg == NULL)
 		return;
@@ -262,11 +303,12 @@ static void prop_entry_update(struct prop_entry *prop, DBusMessageIter *iter)
 	dbus_message_iter_init_append(msg, &base);
 	iter_append_iter(&base, iter);
 
+	/* The value is read back in place; copying it only trims the buffer
+	 * at the cost of a second allocation and serialization per change */
 	if (prop->msg != NULL)
 		dbus_message_unref(prop->msg);
 
-	prop->msg = dbus_message_copy(msg);
-	dbus_message_unref(msg);
+	prop->msg = msg;
 }
 
 static struct prop_entry *prop_entry_new(const char *name,
@@ -274,11 +316,11 @@ static struct prop_entry *prop_entry_new(const char *name,
 {
 	struct prop_entry *prop;
 
-	prop = g_try_new0(struct prop_entry, 1);
+	prop = memstat_alloc0(MEMSTAT_PROP_ENTRY, sizeof(*prop));
 	if (prop == NULL)
 		return NULL;
 
-	prop->name = g_strdup(name);
+	prop->name = memstat_strdup(MEMSTAT_PROP_ENTRY, name);
 	prop->type = dbus_message_iter_get_arg_type(iter);
 
 	prop_entry_update(prop, iter);
@@ -293,9 +335,9 @@ static void prop_entry_free(gpointer data)
 	if (prop->msg != NULL)
 		dbus_message_unref(prop->msg);
 
-	g_free(prop->name);
+	memstat_free_string(MEMSTAT_PROP_ENTRY, prop->name);
 
-	g_free(prop);
+	memstat_free(MEMSTAT_PROP_ENTRY, prop, sizeof(*prop));
 }
 
 static void add_property(GDBusProxy *proxy, const char *name,
@@ -323,6 +365,8 @@ static void add_property(GDBusProxy *proxy, const char *name,
 	g_hash_table_replace(proxy->prop_list, prop->name, prop);
 
 done:
+	PROBE3(prop_update, proxy->obj_path, name, send_changed);
+
 	if (proxy->prop_func)
 		proxy->prop_func(proxy, name, &value, proxy->prop_data);
 
@@ -528,13 +572,13 @@ static GDBusProxy *proxy_new(GDBusClient *client, const char *path,
 {
 	GDBusProxy *proxy;
 
-	proxy = g_try_new0(GDBusProxy, 1);
+	proxy = memstat_alloc0(MEMSTAT_PROXY, sizeof(*proxy));
 	if (proxy == NULL)
 		return NULL;
 
 	proxy->client = client;
-	proxy->obj_path = g_strdup(path);
-	proxy->interface = g_strdup(interface);
+	proxy->obj_path = memstat_strdup(MEMSTAT_PROXY, path);
+	proxy->interface = memstat_strdup(MEMSTAT_PROXY, interface);
 
 	proxy->prop_list = g_hash_table_new_full(g_str_hash, g_str_equal,
 							NULL, prop_entry_free);
@@ -548,6 +592,8 @@ static GDBusProxy *proxy_new(GDBusClient *client, const char *path,
 
 	client->proxy_list = g_list_append(client->proxy_list, proxy);
 
+	PROBE3(proxy_new, proxy, proxy->obj_path, proxy->interface);
+
 	return g_dbus_proxy_ref(proxy);
 }
 
@@ -674,10 +720,12 @@ void g_dbus_proxy_unref(GDBusProxy *proxy)
 
 	g_hash_table_destroy(proxy->prop_list);
 
-	g_free(proxy->obj_path);
-	g_free(proxy->interface);
+	PROBE2(proxy_free, proxy, proxy->obj_path);
+
+	memstat_free_string(MEMSTAT_PROXY, proxy->obj_path);
+	memstat_free_string(MEMSTAT_PROXY, proxy->interface);
 
-	g_free(proxy);
+	memstat_free(MEMSTAT_PROXY, proxy, sizeof(*proxy));
 }
 
 const char *g_dbus_proxy_get_path(const GDBusProxy *proxy)
@@ -727,7 +775,7 @@ static void refresh_property_free(gpointer user_data)
 	struct refresh_property_data *data = user_data;
 
 	g_free(data->name);
-	g_free(data);
+	memstat_free(MEMSTAT_PENDING_CALL, data, sizeof(*data));
 }
 
 static void refresh_property_reply(DBusPendingCall *call, void *user_data)
@@ -765,7 +813,7 @@ gboolean g_dbus_proxy_refresh_property(GDBusProxy *proxy, const char *name)
 	if (client == NULL)
 		return FALSE;
 
-	data = g_try_new0(struct refresh_property_data, 1);
+	data = memstat_alloc0(MEMSTAT_PENDING_CALL, sizeof(*data));
 	if (data == NULL)
 		return FALSE;
 
@@ -806,6 +854,12 @@ struct set_property_data {
 	GDBusDestroyFunction destroy;
 };
 
+static void set_property_free(void *user_data)
+{
+	memstat_free(MEMSTAT_PENDING_CALL, user_data,
+					sizeof(struct set_property_data));
+}
+
 static void set_property_reply(DBusPendingCall *call, void *user_data)
 {
 	struct set_property_data *data = user_data;
@@ -848,7 +902,7 @@ gboolean g_dbus_proxy_set_property_basic(GDBusProxy *proxy,
 	if (client == NULL)
 		return FALSE;
 
-	data = g_try_new0(struct set_property_data, 1);
+	data = memstat_alloc0(MEMSTAT_PENDING_CALL, sizeof(*data));
 	if (data == NULL)
 		return FALSE;
 
@@ -859,7 +913,7 @@ gboolean g_dbus_proxy_set_property_basic(GDBusProxy *proxy,
 	msg = dbus_message_new_method_call(client->service_name,
 			proxy->obj_path, DBUS_INTERFACE_PROPERTIES, "Set");
 	if (msg == NULL) {
-		g_free(data);
+		set_property_free(data);
 		return FALSE;
 	}
 
@@ -873,11 +927,12 @@ gboolean g_dbus_proxy_set_property_basic(GDBusProxy *proxy,
 	if (g_dbus_send_message_with_reply(client->dbus_conn, msg,
 							&call, -1) == FALSE) {
 		dbus_message_unref(msg);
-		g_free(data);
+		set_property_free(data);
 		return FALSE;
 	}
 
-	dbus_pending_call_set_notify(call, set_property_reply, data, g_free);
+	dbus_pending_call_set_notify(call, set_property_reply, data,
+							set_property_free);
 	dbus_pending_call_unref(call);
 
 	dbus_message_unref(msg);
@@ -906,7 +961,7 @@ gboolean g_dbus_proxy_set_property_array(GDBusProxy *proxy,
 	if (!client)
 		return FALSE;
 
-	data = g_try_new0(struct set_property_data, 1);
+	data = memstat_alloc0(MEMSTAT_PENDING_CALL, sizeof(*data));
 	if (!data)
 		return FALSE;
 
@@ -919,7 +974,7 @@ gboolean g_dbus_proxy_set_property_array(GDBusProxy *proxy,
 						DBUS_INTERFACE_PROPERTIES,
 						"Set");
 	if (!msg) {
-		g_free(data);
+		set_property_free(data);
 		return FALSE;
 	}
 
@@ -933,11 +988,12 @@ gboolean g_dbus_proxy_set_property_array(GDBusProxy *proxy,
 	if (g_dbus_send_message_with_reply(client->dbus_conn, msg,
 							&call, -1) == FALSE) {
 		dbus_message_unref(msg);
-		g_free(data);
+		set_property_free(data);
 		return FALSE;
 	}
 
-	dbus_pending_call_set_notify(call, set_property_reply, data, g_free);
+	dbus_pending_call_set_notify(call, set_property_reply, data,
+							set_property_free);
 	dbus_pending_call_unref(call);
 
 	dbus_message_unref(msg);
@@ -951,11 +1007,20 @@ struct method_call_data {
 	GDBusDestroyFunction destroy;
 };
 
+static void method_call_free(void *user_data)
+{
+	memstat_free(MEMSTAT_PENDING_CALL, user_data,
+					sizeof(struct method_call_data));
+}
+
 static void method_call_reply(DBusPendingCall *call, void *user_data)
 {
 	struct method_call_data *data = user_data;
 	DBusMessage *reply = dbus_pending_call_steal_reply(call);
 
+	PROBE2(method_reply, data, dbus_message_get_type(reply) ==
+						DBUS_MESSAGE_TYPE_ERROR);
+
 	if (data->function)
 		data->function(reply, data->user_data);
 
@@ -994,10 +1059,12 @@ gboolean g_dbus_proxy_method_call(GDBusProxy *proxy, const char *method,
 		setup(&iter, user_data);
 	}
 
-	if (!function)
+	if (!function) {
+		PROBE3(method_call, NULL, proxy->obj_path, method);
 		return g_dbus_send_message(client->dbus_conn, msg);
+	}
 
-	data = g_try_new0(struct method_call_data, 1);
+	data = memstat_alloc0(MEMSTAT_PENDING_CALL, sizeof(*data));
 	if (data == NULL)
 		return FALSE;
 
@@ -1005,15 +1072,17 @@ gboolean g_dbus_proxy_method_call(GDBusProxy *proxy, const char *method,
 	data->user_data = user_data;
 	data->destroy = destroy;
 
+	PROBE3(method_call, data, proxy->obj_path, method);
 
 	if (g_dbus_send_message_with_reply(client->dbus_conn, msg,
 					&call, METHOD_CALL_TIMEOUT) == FALSE) {
 		dbus_message_unref(msg);
-		g_free(data);
+		method_call_free(data);
 		return FALSE;
 	}
 
-	dbus_pending_call_set_notify(call, method_call_reply, data, g_free);
+	dbus_pending_call_set_notify(call, method_call_reply, data,
+							method_call_free);
 	dbus_pending_call_unref(call);
 
 	dbus_message_unref(msg);
@@ -1221,6 +1290,10 @@ static void get_managed_objects_reply(DBusPendingCall *call, void *user_data)
 		goto done;
 	}
 
+	if (client->record_func)
+		client->record_func(client->dbus_conn, reply,
+							client->record_data);
+
 	parse_managed_objects(client, reply);
 
 done:
@@ -1320,6 +1393,14 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 	path = dbus_message_get_path(message);
 	interface = dbus_message_get_interface(message);
 
+	/* Filters run before the signal watches, so the recording sees
+	 * every signal the client is about to handle, in order */
+	if (client->record_func && (g_str_has_prefix(path, client->base_path) ||
+			(g_strcmp0(path, client->root_path) == 0 &&
+			g_strcmp0(interface,
+				DBUS_INTERFACE_OBJECT_MANAGER) == 0)))
+		client->record_func(connection, message, client->record_data);
+
 	if (g_str_has_prefix(path, client->base_path) == FALSE)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
@@ -1498,6 +1579,18 @@ gboolean g_dbus_client_set_signal_watch(GDBusClient *client,
 	return TRUE;
 }
 
+gboolean g_dbus_client_set_record_watch(GDBusClient *client,
+				GDBusMessageFunction function, void *user_data)
+{
+	if (client == NULL)
+		return FALSE;
+
+	client->record_func = function;
+	client->record_data = user_data;
+
+	return TRUE;
+}
+
 gboolean g_dbus_client_set_ready_watch(GDBusClient *client,
 				GDBusClientFunction ready, void *user_data)
 {
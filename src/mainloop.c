@@ -51,10 +51,18 @@ static gboolean disconnected_signal(DBusConnection *conn,
 	return TRUE;
 }
 
+/* Marks a connection that already has a dispatch idle queued, so a burst
+ * of wakeups does not pile up one GSource per message. Stays -1 if the slot
+ * could not be allocated, which falls back to one idle per wakeup. */
+static dbus_int32_t dispatch_slot = -1;
+
 static gboolean message_dispatch(void *data)
 {
 	DBusConnection *conn = data;
 
+	if (dispatch_slot >= 0)
+		dbus_connection_set_data(conn, dispatch_slot, NULL, NULL);
+
 	/* Dispatch messages */
 	while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS);
 
@@ -66,8 +74,19 @@ static gboolean message_dispatch(void *data)
 static inline void queue_dispatch(DBusConnection *conn,
 						DBusDispatchStatus status)
 {
-	if (status == DBUS_DISPATCH_DATA_REMAINS)
-		g_idle_add(message_dispatch, dbus_connection_ref(conn));
+	if (status != DBUS_DISPATCH_DATA_REMAINS)
+		return;
+
+	if (dispatch_slot >= 0) {
+		if (dbus_connection_get_data(conn, dispatch_slot) != NULL)
+			return;
+
+		/* Without the mark the next wakeup just queues another idle */
+		dbus_connection_set_data(conn, dispatch_slot,
+					GINT_TO_POINTER(TRUE), NULL);
+	}
+
+	g_idle_add(message_dispatch, dbus_connection_ref(conn));
 }
 
 static gboolean watch_func(GIOChannel *chan, GIOCondition cond, gpointer data)
@@ -234,6 +253,9 @@ static void dispatch_status(DBusConnection *conn,
 
 static inline void setup_dbus_with_main_loop(DBusConnection *conn)
 {
+	if (dbus_connection_allocate_data_slot(&dispatch_slot) == FALSE)
+		dispatch_slot = -1;
+
 	dbus_connection_set_watch_functions(conn, add_watch, remove_watch,
 						watch_toggled, conn, NULL);
 
@@ -317,6 +339,32 @@ DBusConnection *g_dbus_setup_private(DBusBusType type, const char *name,
 	return conn;
 }
 
+/* Peer-to-peer connection without a bus, e.g. to replay a recording */
+DBusConnection *g_dbus_setup_address(const char *address, DBusError *error)
+{
+	DBusConnection *conn;
+
+	conn = dbus_connection_open_private(address, error);
+
+	if (error != NULL) {
+		if (dbus_error_is_set(error) == TRUE)
+			return NULL;
+	}
+
+	if (conn == NULL)
+		return NULL;
+
+	dbus_connection_set_exit_on_disconnect(conn, FALSE);
+
+	if (setup_bus(conn, NULL, error) == FALSE) {
+		dbus_connection_close(conn);
+		dbus_connection_unref(conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
 gboolean g_dbus_request_name(DBusConnection *connection, const char *name,
 							DBusError *error)
 {
@@ -0,0 +1,94 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "bluetooth_internal.h"
+#include "memstat.h"
+
+MemStat memstat_table[MEMSTAT_NUM];
+
+global_variable const char *memstat_category_strings[MEMSTAT_NUM] = {
+    "proxies", "prop entries", "pending calls", "watches", "watch callbacks",
+    "objects", "interfaces",   "devices",       "entries", "strings"};
+
+/** ALLOCATION **/
+
+void *memstat_alloc0(u32 category, gsize size) {
+    void *ptr = g_malloc0(size);
+    memstat_add(category, size, 1);
+    return ptr;
+}
+
+void memstat_free(u32 category, void *ptr, gsize size) {
+    if (ptr == NULL)
+        return;
+    memstat_add(category, -(i64)size, -1);
+    g_free(ptr);
+}
+
+// Strings are counted as bytes only; the object they belong to is the
+// counted object.
+char *memstat_strdup(u32 category, const char *string) {
+    if (string == NULL)
+        return NULL;
+    gsize size = strlen(string) + 1;
+    memstat_add(category, size, 0);
+    char *copy = g_malloc(size);
+    memcpy(copy, string, size);
+    return copy;
+}
+
+void memstat_free_string(u32 category, char *string) {
+    if (string == NULL)
+        return;
+    memstat_add(category, -(i64)(strlen(string) + 1), 0);
+    g_free(string);
+}
+
+/** QUERY **/
+
+const char *memstat_category_name(u32 category) {
+    return category < MEMSTAT_NUM ? memstat_category_strings[category] : NULL;
+}
+
+void memstat_get(u32 category, MemStat *stat) {
+    if (category < MEMSTAT_NUM)
+        *stat = memstat_table[category];
+}
+
+void memstat_dump(GLogLevelFlags level) {
+    i64 total = 0;
+    for (u32 i = 0; i < MEMSTAT_NUM; i++) {
+        MemStat *stat = &memstat_table[i];
+        total += stat->bytes;
+        g_log(G_LOG_DOMAIN, level,
+              "memstat %-16s %8" G_GINT64_FORMAT " bytes %6" G_GINT64_FORMAT " live %8" G_GINT64_FORMAT
+              " peak bytes %8" G_GUINT64_FORMAT " allocations",
+              memstat_category_strings[i], stat->bytes, stat->objects, stat->peak_bytes, stat->allocations);
+    }
+    g_log(G_LOG_DOMAIN, level, "memstat %-16s %8" G_GINT64_FORMAT " bytes", "total", total);
+}
@@ -19,6 +19,7 @@
 #include <dbus/dbus.h>
 
 #include "gdbus.h"
+#include "memstat.h"
 
 #define info(fmt...)
 #define error(fmt...)
@@ -43,9 +44,11 @@ struct generic_data {
 	GSList *added;
 	GSList *removed;
 	guint process_id;
+	GList *pending_link;
 	gboolean pending_prop;
 	char *introspect;
 	struct generic_data *parent;
+	GHashTable *methods;
 };
 
 struct interface_data {
@@ -53,12 +56,21 @@ struct interface_data {
 	const GDBusMethodTable *methods;
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
-	GSList *pending_prop;
+	GHashTable *prop_index;
+	unsigned int n_properties;
+	unsigned long *pending_prop;
+	unsigned int n_pending;
 	void *user_data;
 	GDBusDestroyFunction destroy;
 };
 
+struct method_data {
+	struct interface_data *iface;
+	const GDBusMethodTable *method;
+};
+
 struct security_data {
+	gint64 start;
 	GDBusPendingReply pending;
 	DBusMessage *message;
 	const GDBusMethodTable *method;
@@ -66,6 +78,7 @@ struct security_data {
 };
 
 struct property_data {
+	gint64 start;
 	DBusConnection *conn;
 	GDBusPendingPropertySet id;
 	DBusMessage *message;
@@ -73,7 +86,7 @@ struct property_data {
 
 static int global_flags = 0;
 static struct generic_data *root;
-static GSList *pending = NULL;
+static dbus_int32_t pending_slot = -1;
 
 static gboolean process_changes(gpointer user_data);
 static void process_properties_from_interface(struct generic_data *data,
@@ -265,54 +278,118 @@ static DBusHandlerResult process_message(DBusConnection *connection,
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
+/*
+ * Outstanding security checks and property sets are keyed by their id so
+ * that completion is a single lookup. Each table knows where the start
+ * time lives in its entry type, which is all the age accounting needs.
+ */
+struct pending_table {
+	GHashTable *entries;
+	glong start_offset;
+	guint64 completed;
+	gint64 total_latency;
+};
+
+#define PENDING_START(table, entry) \
+	G_STRUCT_MEMBER(gint64, (entry), (table)->start_offset)
+
+static void pending_table_add(struct pending_table *table, guint32 id,
+								void *entry)
+{
+	if (table->entries == NULL)
+		table->entries = g_hash_table_new(g_direct_hash,
+							g_direct_equal);
+
+	PENDING_START(table, entry) = g_get_monotonic_time();
+
+	g_hash_table_insert(table->entries, GUINT_TO_POINTER(id), entry);
+}
+
+static void *pending_table_remove(struct pending_table *table, guint32 id)
+{
+	void *entry;
+
+	if (table->entries == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup(table->entries, GUINT_TO_POINTER(id));
+	if (entry == NULL)
+		return NULL;
+
+	g_hash_table_remove(table->entries, GUINT_TO_POINTER(id));
+
+	table->completed++;
+	table->total_latency += g_get_monotonic_time() -
+						PENDING_START(table, entry);
+
+	return entry;
+}
+
+static void pending_table_stats(struct pending_table *table,
+						GDBusPendingStats *stats)
+{
+	GHashTableIter iter;
+	gpointer entry;
+	gint64 now, oldest;
+
+	memset(stats, 0, sizeof(*stats));
+
+	stats->completed = table->completed;
+	stats->total_latency = table->total_latency;
+
+	if (table->entries == NULL)
+		return;
+
+	stats->outstanding = g_hash_table_size(table->entries);
+
+	now = g_get_monotonic_time();
+	oldest = now;
+
+	g_hash_table_iter_init(&iter, table->entries);
+	while (g_hash_table_iter_next(&iter, NULL, &entry))
+		oldest = MIN(oldest, PENDING_START(table, entry));
+
+	stats->oldest_age = now - oldest;
+}
+
 static GDBusPendingReply next_pending = 1;
-static GSList *pending_security = NULL;
+static struct pending_table pending_security = {
+	.start_offset = G_STRUCT_OFFSET(struct security_data, start),
+};
 
 static const GDBusSecurityTable *security_table = NULL;
 
 void g_dbus_pending_success(DBusConnection *connection,
 					GDBusPendingReply pending)
 {
-	GSList *list;
+	struct security_data *secdata;
 
-	for (list = pending_security; list; list = list->next) {
-		struct security_data *secdata = list->data;
-
-		if (secdata->pending != pending)
-			continue;
-
-		pending_security = g_slist_remove(pending_security, secdata);
+	secdata = pending_table_remove(&pending_security, pending);
+	if (secdata == NULL)
+		return;
 
-		process_message(connection, secdata->message,
+	process_message(connection, secdata->message,
 				secdata->method, secdata->iface_user_data);
 
-		dbus_message_unref(secdata->message);
-		g_free(secdata);
-		return;
-	}
+	dbus_message_unref(secdata->message);
+	g_free(secdata);
 }
 
 void g_dbus_pending_error_valist(DBusConnection *connection,
 				GDBusPendingReply pending, const char *name,
 					const char *format, va_list args)
 {
-	GSList *list;
+	struct security_data *secdata;
 
-	for (list = pending_security; list; list = list->next) {
-		struct security_data *secdata = list->data;
-
-		if (secdata->pending != pending)
-			continue;
-
-		pending_security = g_slist_remove(pending_security, secdata);
+	secdata = pending_table_remove(&pending_security, pending);
+	if (secdata == NULL)
+		return;
 
-		g_dbus_send_error_valist(connection, secdata->message,
+	g_dbus_send_error_valist(connection, secdata->message,
 							name, format, args);
 
-		dbus_message_unref(secdata->message);
-		g_free(secdata);
-		return;
-	}
+	dbus_message_unref(secdata->message);
+	g_free(secdata);
 }
 
 void g_dbus_pending_error(DBusConnection *connection,
@@ -328,11 +405,12 @@ void g_dbus_pending_error(DBusConnection *connection,
 	va_end(args);
 }
 
-int polkit_check_authorization(DBusConnection *conn,
+int polkit_check_authorization(DBusConnection *conn, const char *sender,
 				const char *action, gboolean interaction,
 				void (*function) (dbus_bool_t authorized,
 							void *user_data),
 						void *user_data, int timeout);
+void polkit_set_cache_ttl(unsigned int ttl);
 
 struct builtin_security_data {
 	DBusConnection *conn;
@@ -353,6 +431,7 @@ static void builtin_security_result(dbus_bool_t authorized, void *user_data)
 }
 
 static void builtin_security_function(DBusConnection *conn,
+						const char *sender,
 						const char *action,
 						gboolean interaction,
 						GDBusPendingReply pending)
@@ -363,9 +442,16 @@ static void builtin_security_function(DBusConnection *conn,
 	data->conn = conn;
 	data->pending = pending;
 
-	if (polkit_check_authorization(conn, action, interaction,
-				builtin_security_result, data, 30000) < 0)
+	if (polkit_check_authorization(conn, sender, action, interaction,
+				builtin_security_result, data, 30000) < 0) {
+		g_free(data);
 		g_dbus_pending_error(conn, pending, NULL, NULL);
+	}
+}
+
+void g_dbus_set_security_cache_ttl(unsigned int ttl)
+{
+	polkit_set_cache_ttl(ttl);
 }
 
 static gboolean check_privilege(DBusConnection *conn, DBusMessage *msg,
@@ -387,7 +473,7 @@ static gboolean check_privilege(DBusConnection *conn, DBusMessage *msg,
 		secdata->method = method;
 		secdata->iface_user_data = iface_user_data;
 
-		pending_security = g_slist_prepend(pending_security, secdata);
+		pending_table_add(&pending_security, secdata->pending, secdata);
 
 		if (security->flags & G_DBUS_SECURITY_FLAG_ALLOW_INTERACTION)
 			interaction = TRUE;
@@ -399,8 +485,10 @@ static gboolean check_privilege(DBusConnection *conn, DBusMessage *msg,
 			security->function(conn, security->action,
 						interaction, secdata->pending);
 		else
-			builtin_security_function(conn, security->action,
-						interaction, secdata->pending);
+			builtin_security_function(conn,
+						dbus_message_get_sender(msg),
+						security->action, interaction,
+						secdata->pending);
 
 		return TRUE;
 	}
@@ -409,28 +497,14 @@ static gboolean check_privilege(DBusConnection *conn, DBusMessage *msg,
 }
 
 static GDBusPendingPropertySet next_pending_property = 1;
-static GSList *pending_property_set;
+static struct pending_table pending_property_set = {
+	.start_offset = G_STRUCT_OFFSET(struct property_data, start),
+};
 
 static struct property_data *remove_pending_property_data(
 						GDBusPendingPropertySet id)
 {
-	struct property_data *propdata;
-	GSList *l;
-
-	for (l = pending_property_set; l != NULL; l = l->next) {
-		propdata = l->data;
-		if (propdata->id != id)
-			continue;
-
-		break;
-	}
-
-	if (l == NULL)
-		return NULL;
-
-	pending_property_set = g_slist_delete_link(pending_property_set, l);
-
-	return propdata;
+	return pending_table_remove(&pending_property_set, id);
 }
 
 void g_dbus_pending_property_success(GDBusPendingPropertySet id)
@@ -476,6 +550,16 @@ void g_dbus_pending_property_error(GDBusPendingReply id, const char *name,
 	va_end(args);
 }
 
+void g_dbus_get_pending_security_stats(GDBusPendingStats *stats)
+{
+	pending_table_stats(&pending_security, stats);
+}
+
+void g_dbus_get_pending_property_stats(GDBusPendingStats *stats)
+{
+	pending_table_stats(&pending_property_set, stats);
+}
+
 static void reset_parent(gpointer data, gpointer user_data)
 {
 	struct generic_data *child = data;
@@ -582,6 +666,146 @@ static void emit_interfaces_added(struct generic_data *data)
 	dbus_message_unref(signal);
 }
 
+#define PENDING_PROP_BITS (sizeof(unsigned long) * 8)
+
+static void add_properties(struct interface_data *iface)
+{
+	const GDBusPropertyTable *p;
+	unsigned int i, words;
+
+	for (p = iface->properties; p && p->name; p++)
+		iface->n_properties++;
+
+	if (iface->n_properties == 0)
+		return;
+
+	iface->prop_index = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (i = 0; i < iface->n_properties; i++) {
+		const char *name = iface->properties[i].name;
+
+		/* First declaration wins, as with the old linear scan */
+		if (g_hash_table_contains(iface->prop_index, name))
+			continue;
+
+		g_hash_table_insert(iface->prop_index, (gpointer) name,
+							GUINT_TO_POINTER(i + 1));
+	}
+
+	words = (iface->n_properties + PENDING_PROP_BITS - 1) /
+							PENDING_PROP_BITS;
+	iface->pending_prop = g_new0(unsigned long, words);
+}
+
+static void remove_properties(struct interface_data *iface)
+{
+	if (iface->prop_index != NULL) {
+		g_hash_table_destroy(iface->prop_index);
+		iface->prop_index = NULL;
+	}
+
+	g_free(iface->pending_prop);
+	iface->pending_prop = NULL;
+	iface->n_pending = 0;
+}
+
+/*
+ * Method dispatch key is "interface.member(signature)"; none of the three
+ * components may contain '(' so the encoding is unambiguous.
+ */
+#define METHOD_KEY_SIZE (3 * DBUS_MAXIMUM_NAME_LENGTH + 4)
+
+static char *method_key_new(const char *interface,
+					const GDBusMethodTable *method)
+{
+	const GDBusArgInfo *arg;
+	GString *gstr;
+
+	gstr = g_string_new(interface);
+	g_string_append_printf(gstr, ".%s(", method->name);
+
+	for (arg = method->in_args; arg && arg->signature; arg++)
+		g_string_append(gstr, arg->signature);
+
+	g_string_append_c(gstr, ')');
+
+	return g_string_free(gstr, FALSE);
+}
+
+static void add_methods(struct generic_data *data,
+					struct interface_data *iface)
+{
+	const GDBusMethodTable *method;
+
+	if (data->methods == NULL)
+		data->methods = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, g_free);
+
+	for (method = iface->methods; method &&
+			method->name && method->function; method++) {
+		struct method_data *entry;
+		char *key;
+
+		key = method_key_new(iface->name, method);
+
+		/* First declaration wins, as with the old linear scan */
+		if (g_hash_table_contains(data->methods, key)) {
+			g_free(key);
+			continue;
+		}
+
+		entry = g_new0(struct method_data, 1);
+		entry->iface = iface;
+		entry->method = method;
+
+		g_hash_table_insert(data->methods, key, entry);
+	}
+}
+
+static gboolean method_data_match_iface(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct method_data *entry = value;
+
+	return entry->iface == user_data;
+}
+
+static void remove_methods(struct generic_data *data,
+					struct interface_data *iface)
+{
+	if (data->methods == NULL)
+		return;
+
+	g_hash_table_foreach_remove(data->methods, method_data_match_iface,
+									iface);
+}
+
+static struct method_data *find_method(struct generic_data *data,
+							DBusMessage *message)
+{
+	char key[METHOD_KEY_SIZE];
+	const char *interface, *member, *signature;
+
+	if (data->methods == NULL)
+		return NULL;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return NULL;
+
+	interface = dbus_message_get_interface(message);
+	member = dbus_message_get_member(message);
+	if (interface == NULL || member == NULL)
+		return NULL;
+
+	signature = dbus_message_get_signature(message);
+
+	if (snprintf(key, sizeof(key), "%s.%s(%s)", interface, member,
+					signature) >= (int) sizeof(key))
+		return NULL;
+
+	return g_hash_table_lookup(data->methods, key);
+}
+
 static struct interface_data *find_interface(GSList *interfaces,
 						const char *name)
 {
@@ -620,9 +844,41 @@ static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 	return TRUE;
 }
 
+/*
+ * Objects with queued changes are kept on a per-connection queue, stored
+ * as connection data, so that flushing one connection neither walks nor
+ * filters the objects of another.
+ */
+static GQueue *pending_queue(DBusConnection *conn, gboolean create)
+{
+	GQueue *queue;
+
+	if (pending_slot < 0) {
+		if (!create)
+			return NULL;
+
+		if (!dbus_connection_allocate_data_slot(&pending_slot))
+			return NULL;
+	}
+
+	queue = dbus_connection_get_data(conn, pending_slot);
+	if (queue != NULL || !create)
+		return queue;
+
+	queue = g_queue_new();
+	if (!dbus_connection_set_data(conn, pending_slot, queue,
+					(DBusFreeFunction) g_queue_free)) {
+		g_queue_free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
 static void add_pending(struct generic_data *data)
 {
 	guint old_id = data->process_id;
+	GQueue *queue;
 
 	data->process_id = g_idle_add(process_changes, data);
 
@@ -635,7 +891,12 @@ static void add_pending(struct generic_data *data)
 		return;
 	}
 
-	pending = g_slist_append(pending, data);
+	queue = pending_queue(data->conn, TRUE);
+	if (queue == NULL)
+		return;
+
+	g_queue_push_tail(queue, data);
+	data->pending_link = queue->tail;
 }
 
 static gboolean remove_interface(struct generic_data *data, const char *name)
@@ -649,6 +910,8 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 	process_properties_from_interface(data, iface);
 
 	data->interfaces = g_slist_remove(data->interfaces, iface);
+	remove_methods(data, iface);
+	remove_properties(iface);
 
 	if (iface->destroy) {
 		iface->destroy(iface->user_data);
@@ -662,18 +925,18 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 	if (g_slist_find(data->added, iface)) {
 		data->added = g_slist_remove(data->added, iface);
 		g_free(iface->name);
-		g_free(iface);
+		memstat_free(MEMSTAT_INTERFACE, iface, sizeof(*iface));
 		return TRUE;
 	}
 
 	if (data->parent == NULL) {
 		g_free(iface->name);
-		g_free(iface);
+		memstat_free(MEMSTAT_INTERFACE, iface, sizeof(*iface));
 		return TRUE;
 	}
 
 	data->removed = g_slist_prepend(data->removed, iface->name);
-	g_free(iface);
+	memstat_free(MEMSTAT_INTERFACE, iface, sizeof(*iface));
 
 	add_pending(data);
 
@@ -730,23 +993,27 @@ done:
 	return data;
 }
 
-static inline const GDBusPropertyTable *find_property(const GDBusPropertyTable *properties,
-							const char *name)
+static inline const GDBusPropertyTable *find_property(
+						struct interface_data *iface,
+						const char *name)
 {
 	const GDBusPropertyTable *p;
+	gpointer index;
 
-	for (p = properties; p && p->name; p++) {
-		if (strcmp(name, p->name) != 0)
-			continue;
+	if (iface->prop_index == NULL || name == NULL)
+		return NULL;
 
-		if (check_experimental(p->flags,
-					G_DBUS_PROPERTY_FLAG_EXPERIMENTAL))
-			break;
+	/* Indexes are stored off by one so that NULL means not found */
+	index = g_hash_table_lookup(iface->prop_index, name);
+	if (index == NULL)
+		return NULL;
 
-		return p;
-	}
+	p = &iface->properties[GPOINTER_TO_UINT(index) - 1];
 
-	return NULL;
+	if (check_experimental(p->flags, G_DBUS_PROPERTY_FLAG_EXPERIMENTAL))
+		return NULL;
+
+	return p;
 }
 
 static DBusMessage *properties_get(DBusConnection *connection,
@@ -770,7 +1037,7 @@ static DBusMessage *properties_get(DBusConnection *connection,
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 				"No such interface '%s'", interface);
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL)
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 				"No such property '%s'", name);
@@ -876,7 +1143,7 @@ static DBusMessage *properties_set(DBusConnection *connection,
 		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
 					"No such interface '%s'", interface);
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL)
 		return g_dbus_create_error(message,
 						DBUS_ERROR_UNKNOWN_PROPERTY,
@@ -905,7 +1172,7 @@ static DBusMessage *properties_set(DBusConnection *connection,
 	propdata->id = next_pending_property++;
 	propdata->message = dbus_message_ref(message);
 	propdata->conn = connection;
-	pending_property_set = g_slist_prepend(pending_property_set, propdata);
+	pending_table_add(&pending_property_set, propdata->id, propdata);
 
 	property->set(property, &sub, propdata->id, iface->user_data);
 
@@ -978,12 +1245,21 @@ static void emit_interfaces_removed(struct generic_data *data)
 
 static void remove_pending(struct generic_data *data)
 {
+	GQueue *queue;
+
 	if (data->process_id > 0) {
 		g_source_remove(data->process_id);
 		data->process_id = 0;
 	}
 
-	pending = g_slist_remove(pending, data);
+	if (data->pending_link == NULL)
+		return;
+
+	queue = pending_queue(data->conn, FALSE);
+	if (queue != NULL)
+		g_queue_delete_link(queue, data->pending_link);
+
+	data->pending_link = NULL;
 }
 
 static gboolean process_changes(gpointer user_data)
@@ -1024,50 +1300,38 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	g_slist_foreach(data->objects, reset_parent, data->parent);
 	g_slist_free(data->objects);
 
+	if (data->methods != NULL)
+		g_hash_table_destroy(data->methods);
+
 	dbus_connection_unref(data->conn);
 	g_free(data->introspect);
 	g_free(data->path);
-	g_free(data);
+	memstat_free(MEMSTAT_OBJECT, data, sizeof(*data));
 }
 
 static DBusHandlerResult generic_message(DBusConnection *connection,
 					DBusMessage *message, void *user_data)
 {
 	struct generic_data *data = user_data;
-	struct interface_data *iface;
+	struct method_data *entry;
 	const GDBusMethodTable *method;
-	const char *interface;
-
-	interface = dbus_message_get_interface(message);
 
-	iface = find_interface(data->interfaces, interface);
-	if (iface == NULL)
+	entry = find_method(data, message);
+	if (entry == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (method = iface->methods; method &&
-			method->name && method->function; method++) {
+	method = entry->method;
 
-		if (dbus_message_is_method_call(message, iface->name,
-							method->name) == FALSE)
-			continue;
-
-		if (check_experimental(method->flags,
-					G_DBUS_METHOD_FLAG_EXPERIMENTAL))
-			return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-
-		if (g_dbus_args_have_signature(method->in_args,
-							message) == FALSE)
-			continue;
-
-		if (check_privilege(connection, message, method,
-						iface->user_data) == TRUE)
-			return DBUS_HANDLER_RESULT_HANDLED;
+	if (check_experimental(method->flags,
+				G_DBUS_METHOD_FLAG_EXPERIMENTAL))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-		return process_message(connection, message, method,
-							iface->user_data);
-	}
+	if (check_privilege(connection, message, method,
+					entry->iface->user_data) == TRUE)
+		return DBUS_HANDLER_RESULT_HANDLED;
 
-	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	return process_message(connection, message, method,
+						entry->iface->user_data);
 }
 
 static DBusObjectPathVTable generic_table = {
@@ -1202,7 +1466,7 @@ static gboolean add_interface(struct generic_data *data,
 	return FALSE;
 
 done:
-	iface = g_new0(struct interface_data, 1);
+	iface = memstat_alloc0(MEMSTAT_INTERFACE, sizeof(*iface));
 	iface->name = g_strdup(name);
 	iface->methods = methods;
 	iface->signals = signals;
@@ -1211,6 +1475,8 @@ done:
 	iface->destroy = destroy;
 
 	data->interfaces = g_slist_append(data->interfaces, iface);
+	add_methods(data, iface);
+	add_properties(iface);
 	if (data->parent == NULL)
 		return TRUE;
 
@@ -1234,7 +1500,7 @@ static struct generic_data *object_path_ref(DBusConnection *connection,
 		}
 	}
 
-	data = g_new0(struct generic_data, 1);
+	data = memstat_alloc0(MEMSTAT_OBJECT, sizeof(*data));
 	data->conn = dbus_connection_ref(connection);
 	data->path = g_strdup(path);
 	data->refcount = 1;
@@ -1246,7 +1512,7 @@ static struct generic_data *object_path_ref(DBusConnection *connection,
 		dbus_connection_unref(data->conn);
 		g_free(data->path);
 		g_free(data->introspect);
-		g_free(data);
+		memstat_free(MEMSTAT_OBJECT, data, sizeof(*data));
 		return NULL;
 	}
 
@@ -1482,17 +1748,19 @@ DBusMessage *g_dbus_create_reply(DBusMessage *message, int type, ...)
 
 static void g_dbus_flush(DBusConnection *connection)
 {
-	GSList *l;
+	GQueue *queue;
+	guint count;
 
-	for (l = pending; l;) {
-		struct generic_data *data = l->data;
-
-		l = l->next;
-		if (data->conn != connection)
-			continue;
+	queue = pending_queue(connection, FALSE);
+	if (queue == NULL || g_queue_is_empty(queue))
+		return;
 
-		process_changes(data);
-	}
+	/*
+	 * Only flush what was queued on entry; objects re-queued while
+	 * processing are left for their idler, as before.
+	 */
+	for (count = queue->length; count > 0 && queue->head; count--)
+		process_changes(queue->head->data);
 }
 
 gboolean g_dbus_send_message(DBusConnection *connection, DBusMessage *message)
@@ -1661,8 +1929,9 @@ static void process_properties_from_interface(struct generic_data *data,
 	DBusMessage *signal;
 	DBusMessageIter iter, dict, array;
 	GSList *invalidated;
+	unsigned int word, words;
 
-	if (iface->pending_prop == NULL)
+	if (iface->n_pending == 0)
 		return;
 
 	signal = dbus_message_new_signal(data->path,
@@ -1673,8 +1942,6 @@ static void process_properties_from_interface(struct generic_data *data,
 		return;
 	}
 
-	iface->pending_prop = g_slist_reverse(iface->pending_prop);
-
 	dbus_message_iter_init_append(signal, &iter);
 	dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING,	&iface->name);
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
@@ -1684,22 +1951,42 @@ static void process_properties_from_interface(struct generic_data *data,
 
 	invalidated = NULL;
 
-	for (l = iface->pending_prop; l != NULL; l = l->next) {
-		GDBusPropertyTable *p = l->data;
+	/* Walk only the set bits, in property table order */
+	words = (iface->n_properties + PENDING_PROP_BITS - 1) /
+							PENDING_PROP_BITS;
 
-		if (p->get == NULL)
-			continue;
+	for (word = 0; word < words; word++) {
+		unsigned long bits = iface->pending_prop[word];
 
-		if (p->exists != NULL && !p->exists(p, iface->user_data)) {
-			invalidated = g_slist_prepend(invalidated, p);
-			continue;
-		}
+		iface->pending_prop[word] = 0;
+
+		while (bits) {
+			unsigned int bit = __builtin_ctzl(bits);
+			const GDBusPropertyTable *p;
+
+			bits &= bits - 1;
+			p = &iface->properties[word * PENDING_PROP_BITS + bit];
+
+			if (p->get == NULL)
+				continue;
+
+			if (p->exists != NULL &&
+					!p->exists(p, iface->user_data)) {
+				invalidated = g_slist_prepend(invalidated,
+								(void *) p);
+				continue;
+			}
 
-		append_property(iface, p, &dict);
+			append_property(iface, p, &dict);
+		}
 	}
 
+	iface->n_pending = 0;
+
 	dbus_message_iter_close_container(&iter, &dict);
 
+	invalidated = g_slist_reverse(invalidated);
+
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
 				DBUS_TYPE_STRING_AS_STRING, &array);
 	for (l = invalidated; l != NULL; l = g_slist_next(l)) {
@@ -1711,9 +1998,6 @@ static void process_properties_from_interface(struct generic_data *data,
 	g_slist_free(invalidated);
 	dbus_message_iter_close_container(&iter, &array);
 
-	g_slist_free(iface->pending_prop);
-	iface->pending_prop = NULL;
-
 	/* Use dbus_connection_send to avoid recursive calls to g_dbus_flush */
 	dbus_connection_send(data->conn, signal, NULL);
 	dbus_message_unref(signal);
@@ -1740,6 +2024,8 @@ void g_dbus_emit_property_changed_full(DBusConnection *connection,
 	const GDBusPropertyTable *property;
 	struct generic_data *data;
 	struct interface_data *iface;
+	unsigned long bit;
+	unsigned int index;
 
 	if (path == NULL)
 		return;
@@ -1759,19 +2045,22 @@ void g_dbus_emit_property_changed_full(DBusConnection *connection,
 	if (root && g_slist_find(data->added, iface))
 		return;
 
-	property = find_property(iface->properties, name);
+	property = find_property(iface, name);
 	if (property == NULL) {
 		error("Could not find property %s in %p", name,
 							iface->properties);
 		return;
 	}
 
-	if (g_slist_find(iface->pending_prop, (void *) property) != NULL)
+	index = property - iface->properties;
+	bit = 1UL << (index % PENDING_PROP_BITS);
+
+	if (iface->pending_prop[index / PENDING_PROP_BITS] & bit)
 		return;
 
 	data->pending_prop = TRUE;
-	iface->pending_prop = g_slist_prepend(iface->pending_prop,
-						(void *) property);
+	iface->pending_prop[index / PENDING_PROP_BITS] |= bit;
+	iface->n_pending++;
 
 	if (flags & G_DBUS_PROPERTY_CHANGED_FLAG_FLUSH)
 		process_property_changes(data);
@@ -18,11 +18,14 @@
 
 #include <glib.h>
 
-int polkit_check_authorization(DBusConnection *conn,
+#include "gdbus.h"
+
+int polkit_check_authorization(DBusConnection *conn, const char *sender,
 				const char *action, gboolean interaction,
 				void (*function) (dbus_bool_t authorized,
 							void *user_data),
 						void *user_data, int timeout);
+void polkit_set_cache_ttl(unsigned int ttl);
 
 static void add_dict_with_string_value(DBusMessageIter *iter,
 					const char *key, const char *str)
@@ -60,9 +63,10 @@ static void add_empty_string_dict(DBusMessageIter *iter)
 }
 
 static void add_arguments(DBusConnection *conn, DBusMessageIter *iter,
-				const char *action, dbus_uint32_t flags)
+				const char *sender, const char *action,
+				dbus_uint32_t flags)
 {
-	const char *busname = dbus_bus_get_unique_name(conn);
+	const char *busname = sender ? : dbus_bus_get_unique_name(conn);
 	const char *kind = "system-bus-name";
 	const char *cancel = "";
 	DBusMessageIter subject;
@@ -97,9 +101,152 @@ struct authorization_data {
 	void *user_data;
 };
 
+/*
+ * Results are cached per (sender, action, interaction) for ttl msec and
+ * dropped as soon as the sender leaves the bus. Checks arriving while one
+ * for the same key is in flight are queued on it instead of sending
+ * another CheckAuthorization call.
+ */
+struct authorization_sender {
+	DBusConnection *conn;
+	char *name;
+	guint watch;
+	GHashTable *entries;
+};
+
+struct authorization_entry {
+	char *key;
+	struct authorization_sender *sender;
+	gboolean pending;
+	dbus_bool_t authorized;
+	gint64 expires;
+	GSList *waiters;
+};
+
+static unsigned int cache_ttl = 0;
+static GHashTable *senders = NULL;
+
+void polkit_set_cache_ttl(unsigned int ttl)
+{
+	cache_ttl = ttl;
+}
+
+static void authorization_entry_free(struct authorization_entry *entry)
+{
+	g_slist_free_full(entry->waiters, dbus_free);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+static void authorization_entry_destroy(gpointer user_data)
+{
+	struct authorization_entry *entry = user_data;
+
+	/* The reply handler still owns entries that are in flight */
+	if (entry->pending) {
+		entry->sender = NULL;
+		return;
+	}
+
+	authorization_entry_free(entry);
+}
+
+static void authorization_sender_free(gpointer user_data)
+{
+	struct authorization_sender *sender = user_data;
+
+	if (sender->watch > 0)
+		g_dbus_remove_watch(sender->conn, sender->watch);
+
+	g_hash_table_destroy(sender->entries);
+	dbus_connection_unref(sender->conn);
+	g_free(sender->name);
+	g_free(sender);
+}
+
+static void sender_disconnected(DBusConnection *conn, void *user_data)
+{
+	struct authorization_sender *sender = user_data;
+
+	/* Unique name watches are removed once they fire */
+	sender->watch = 0;
+
+	g_hash_table_remove(senders, sender->name);
+}
+
+static struct authorization_sender *authorization_sender_get(
+					DBusConnection *conn, const char *name)
+{
+	struct authorization_sender *sender;
+
+	if (senders == NULL)
+		senders = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+						authorization_sender_free);
+
+	sender = g_hash_table_lookup(senders, name);
+	if (sender != NULL)
+		return sender->conn == conn ? sender : NULL;
+
+	sender = g_new0(struct authorization_sender, 1);
+	sender->conn = dbus_connection_ref(conn);
+	sender->name = g_strdup(name);
+	sender->entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+						authorization_entry_destroy);
+
+	sender->watch = g_dbus_add_disconnect_watch(conn, name,
+						sender_disconnected, sender,
+						NULL);
+	if (sender->watch == 0) {
+		authorization_sender_free(sender);
+		return NULL;
+	}
+
+	g_hash_table_insert(senders, sender->name, sender);
+
+	return sender;
+}
+
+static void authorization_entry_complete(struct authorization_entry *entry,
+						dbus_bool_t authorized)
+{
+	struct authorization_sender *sender = entry->sender;
+	GSList *waiters, *l;
+
+	/*
+	 * Take the entry out of the cache while the waiters run so that a
+	 * check issued from one of them can't free it underneath us.
+	 */
+	if (sender != NULL)
+		g_hash_table_steal(sender->entries, entry->key);
+
+	entry->pending = FALSE;
+	entry->authorized = authorized;
+	entry->expires = g_get_monotonic_time() + (gint64) cache_ttl * 1000;
+
+	waiters = g_slist_reverse(entry->waiters);
+	entry->waiters = NULL;
+
+	for (l = waiters; l != NULL; l = l->next) {
+		struct authorization_data *data = l->data;
+
+		if (data->function != NULL)
+			data->function(authorized, data->user_data);
+	}
+
+	g_slist_free_full(waiters, dbus_free);
+
+	if (sender == NULL || cache_ttl == 0 ||
+			g_hash_table_contains(sender->entries, entry->key)) {
+		authorization_entry_free(entry);
+		return;
+	}
+
+	g_hash_table_insert(sender->entries, entry->key, entry);
+}
+
 static void authorization_reply(DBusPendingCall *call, void *user_data)
 {
-	struct authorization_data *data = user_data;
+	struct authorization_entry *entry = user_data;
 	DBusMessage *reply;
 	DBusMessageIter iter;
 	dbus_bool_t authorized = FALSE;
@@ -117,8 +264,7 @@ static void authorization_reply(DBusPendingCall *call, void *user_data)
 	authorized = parse_result(&iter);
 
 done:
-	if (data->function != NULL)
-		data->function(authorized, data->user_data);
+	authorization_entry_complete(entry, authorized);
 
 	dbus_message_unref(reply);
 
@@ -129,61 +275,117 @@ done:
 #define AUTHORITY_INTF	"org.freedesktop.PolicyKit1.Authority"
 #define AUTHORITY_PATH	"/org/freedesktop/PolicyKit1/Authority"
 
-int polkit_check_authorization(DBusConnection *conn,
-				const char *action, gboolean interaction,
-				void (*function) (dbus_bool_t authorized,
-							void *user_data),
-						void *user_data, int timeout)
+static int send_check_authorization(DBusConnection *conn, const char *sender,
+					const char *action, gboolean interaction,
+					struct authorization_entry *entry,
+					int timeout)
 {
-	struct authorization_data *data;
 	DBusMessage *msg;
 	DBusMessageIter iter;
 	DBusPendingCall *call;
 	dbus_uint32_t flags = 0x00000000;
 
-	if (conn == NULL)
-		return -EINVAL;
-
-	data = dbus_malloc0(sizeof(*data));
-	if (data == NULL)
-		return -ENOMEM;
-
 	msg = dbus_message_new_method_call(AUTHORITY_DBUS, AUTHORITY_PATH,
 				AUTHORITY_INTF, "CheckAuthorization");
-	if (msg == NULL) {
-		dbus_free(data);
+	if (msg == NULL)
 		return -ENOMEM;
-	}
 
 	if (interaction == TRUE)
 		flags |= 0x00000001;
 
-	if (action == NULL)
-		action = "org.freedesktop.policykit.exec";
-
 	dbus_message_iter_init_append(msg, &iter);
-	add_arguments(conn, &iter, action, flags);
+	add_arguments(conn, &iter, sender, action, flags);
 
 	if (dbus_connection_send_with_reply(conn, msg,
 						&call, timeout) == FALSE) {
 		dbus_message_unref(msg);
-		dbus_free(data);
 		return -EIO;
 	}
 
 	if (call == NULL) {
 		dbus_message_unref(msg);
-		dbus_free(data);
 		return -EIO;
 	}
 
+	dbus_pending_call_set_notify(call, authorization_reply, entry, NULL);
+
+	dbus_message_unref(msg);
+
+	return 0;
+}
+
+int polkit_check_authorization(DBusConnection *conn, const char *sender,
+				const char *action, gboolean interaction,
+				void (*function) (dbus_bool_t authorized,
+							void *user_data),
+						void *user_data, int timeout)
+{
+	struct authorization_sender *owner = NULL;
+	struct authorization_entry *entry = NULL;
+	struct authorization_data *data;
+	char *key;
+	int err;
+
+	if (conn == NULL)
+		return -EINVAL;
+
+	if (action == NULL)
+		action = "org.freedesktop.policykit.exec";
+
+	/* Without a cache there is nothing to key, so don't watch the sender */
+	if (sender != NULL && cache_ttl > 0)
+		owner = authorization_sender_get(conn, sender);
+
+	key = g_strdup_printf("%s:%d", action, interaction);
+
+	if (owner != NULL)
+		entry = g_hash_table_lookup(owner->entries, key);
+
+	if (entry != NULL && !entry->pending &&
+				entry->expires > g_get_monotonic_time()) {
+		g_free(key);
+
+		if (function != NULL)
+			function(entry->authorized, user_data);
+
+		return 0;
+	}
+
+	data = dbus_malloc0(sizeof(*data));
+	if (data == NULL) {
+		g_free(key);
+		return -ENOMEM;
+	}
+
 	data->function = function;
 	data->user_data = user_data;
 
-	dbus_pending_call_set_notify(call, authorization_reply,
-							data, dbus_free);
+	if (entry != NULL && entry->pending) {
+		g_free(key);
+		entry->waiters = g_slist_prepend(entry->waiters, data);
+		return 0;
+	}
+
+	/* Expired entries are replaced by the fresh check */
+	if (entry != NULL)
+		g_hash_table_remove(owner->entries, key);
 
-	dbus_message_unref(msg);
+	entry = g_new0(struct authorization_entry, 1);
+	entry->key = key;
+	entry->pending = TRUE;
+	entry->waiters = g_slist_prepend(NULL, data);
+
+	err = send_check_authorization(conn, sender, action, interaction,
+							entry, timeout);
+	if (err < 0) {
+		authorization_entry_free(entry);
+		return err;
+	}
+
+	if (owner != NULL) {
+		entry->sender = owner;
+		g_hash_table_insert(owner->entries, entry->key, entry);
+	}
 
 	return 0;
 }
@@ -0,0 +1,110 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "record.h"
+
+/** RECORDING **/
+
+Recorder *recorder_open(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        g_warning("unable to open %s for recording", path);
+        return NULL;
+    }
+
+    RecordHeader header = {.magic = RECORD_MAGIC, .version = RECORD_VERSION};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return NULL;
+    }
+
+    Recorder *recorder = g_malloc0(sizeof(Recorder));
+    recorder->file = file;
+    recorder->start = g_get_monotonic_time();
+    return recorder;
+}
+
+void recorder_close(Recorder *recorder) {
+    if (recorder == NULL)
+        return;
+    g_debug("recorded %u messages, %" G_GUINT64_FORMAT " bytes", recorder->messages, recorder->bytes);
+    fclose(recorder->file);
+    g_free(recorder);
+}
+
+void recorder_message(DBusConnection *connection, DBusMessage *message, void *user_data) {
+    Recorder *recorder = user_data;
+    char *data;
+    int length;
+
+    if (recorder == NULL || !dbus_message_marshal(message, &data, &length))
+        return;
+
+    RecordEntry entry = {.timestamp = g_get_monotonic_time() - recorder->start, .length = length};
+    if (fwrite(&entry, sizeof(entry), 1, recorder->file) == 1 && fwrite(data, length, 1, recorder->file) == 1) {
+        recorder->messages++;
+        recorder->bytes += sizeof(entry) + length;
+    }
+    dbus_free(data);
+}
+
+/** REPLAY **/
+
+b32 recording_open(FILE *file) {
+    RecordHeader header;
+    return fread(&header, sizeof(header), 1, file) == 1 && header.magic == RECORD_MAGIC &&
+           header.version == RECORD_VERSION;
+}
+
+// Returns false at the end of the recording or on the first damaged entry.
+b32 recording_next(FILE *file, i64 *timestamp, DBusMessage **message) {
+    RecordEntry entry;
+    DBusError err;
+
+    if (fread(&entry, sizeof(entry), 1, file) != 1 || entry.length == 0 || entry.length > RECORD_MAX_MESSAGE)
+        return false;
+
+    char *data = g_malloc(entry.length);
+    if (fread(data, entry.length, 1, file) != 1) {
+        g_free(data);
+        return false;
+    }
+
+    dbus_error_init(&err);
+    *message = dbus_message_demarshal(data, entry.length, &err);
+    g_free(data);
+    if (*message == NULL) {
+        g_warning("damaged recording: %s", err.message);
+        dbus_error_free(&err);
+        return false;
+    }
+
+    *timestamp = entry.timestamp;
+    return true;
+}
@@ -0,0 +1,67 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm.h"
+
+#define SHM_READ_RETRIES 64
+
+char *shm_snapshot_name(void) {
+    return g_strdup_printf("/rofi-bluetooth-%u", (u32)getuid());
+}
+
+void shm_snapshot_write_begin(ShmSnapshot *shared) {
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void shm_snapshot_write_end(ShmSnapshot *shared) {
+    shared->generation++;
+    __atomic_store_n(&shared->sequence, shared->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Returns false if the writer kept the segment busy for every retry or the
+// layout is not one we understand.
+b32 shm_snapshot_read(const ShmSnapshot *shared, ShmSnapshot *copy) {
+    for (u32 attempt = 0; attempt < SHM_READ_RETRIES; attempt++) {
+        u32 begin = __atomic_load_n(&shared->sequence, __ATOMIC_ACQUIRE);
+        if (begin & 1)
+            continue;
+
+        memcpy(copy, shared, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->sequence, __ATOMIC_RELAXED) != begin)
+            continue;
+
+        return copy->magic == SHM_MAGIC && copy->version == SHM_VERSION &&
+               copy->num_adapters <= SHM_MAX_ADAPTERS && copy->num_devices <= SHM_MAX_DEVICES;
+    }
+    return false;
+}
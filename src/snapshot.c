@@ -0,0 +1,183 @@
+/**
+ * rofi-bluetooth
+ *
+ * MIT/X11 License
+ * Copyright (c) 2020 Rahul Aggarwal <rahulaggarwal965@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+char *snapshot_socket_path(void) {
+    const char *runtime_dir = g_getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && *runtime_dir)
+        return g_build_filename(runtime_dir, SNAPSHOT_SOCKET_NAME, NULL);
+    return g_strdup_printf("/tmp/rofi-bluetooth-%u.sock", (u32)getuid());
+}
+
+// The /tmp fallback can be created by anyone, so only trust a daemon that
+// runs as this user.
+b32 snapshot_peer_is_self(int fd) {
+    struct ucred cred;
+    socklen_t size = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &size) < 0)
+        return false;
+    return cred.uid == getuid();
+}
+
+/** ENCODING **/
+
+// Returns the offset of the frame so its length can be patched in by
+// snapshot_frame_end once the payload is written.
+u32 snapshot_frame_begin(GByteArray *out, u16 type) {
+    SnapshotHeader header = {.magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION, .type = type, .length = 0};
+    u32 frame = out->len;
+    g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+    return frame;
+}
+
+void snapshot_frame_end(GByteArray *out, u32 frame) {
+    SnapshotHeader *header = (SnapshotHeader *)(out->data + frame);
+    header->length = out->len - frame - sizeof(SnapshotHeader);
+}
+
+void snapshot_append_u32(GByteArray *out, u32 value) {
+    g_byte_array_append(out, (const guint8 *)&value, sizeof(value));
+}
+
+internal void append_string(GByteArray *out, const char *str) {
+    u16 length = 0;
+    if (str) {
+        u64 n = strlen(str) + 1;
+        length = n > G_MAXUINT16 ? G_MAXUINT16 : n;
+    }
+    g_byte_array_append(out, (const guint8 *)&length, sizeof(length));
+    if (length) {
+        g_byte_array_append(out, (const guint8 *)str, length - 1);
+        g_byte_array_append(out, (const guint8 *)"", 1);
+    }
+}
+
+void snapshot_append_record(GByteArray *out, const SnapshotRecord *record) {
+    g_byte_array_append(out, &record->kind, sizeof(record->kind));
+    g_byte_array_append(out, &record->flags, sizeof(record->flags));
+    g_byte_array_append(out, (const guint8 *)&record->rssi, sizeof(record->rssi));
+    append_string(out, record->path);
+    append_string(out, record->adapter);
+    append_string(out, record->address);
+    append_string(out, record->name);
+    append_string(out, record->icon);
+}
+
+/** DECODING **/
+
+b32 snapshot_header_valid(const SnapshotHeader *header) {
+    return header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION &&
+           header->length <= SNAPSHOT_MAX_FRAME;
+}
+
+internal b32 read_bytes(SnapshotReader *reader, void *out, u32 size) {
+    if (reader->size - reader->offset < size)
+        return false;
+    memcpy(out, reader->data + reader->offset, size);
+    reader->offset += size;
+    return true;
+}
+
+b32 snapshot_read_u32(SnapshotReader *reader, u32 *value) {
+    return read_bytes(reader, value, sizeof(*value));
+}
+
+// Strings are used in place, so a string must end in the NUL its length
+// promises.
+internal b32 read_string(SnapshotReader *reader, const char **str) {
+    u16 length;
+
+    if (!read_bytes(reader, &length, sizeof(length)))
+        return false;
+    if (length == 0) {
+        *str = NULL;
+        return true;
+    }
+    if (reader->size - reader->offset < length || reader->data[reader->offset + length - 1] != '\0')
+        return false;
+    *str = (const char *)reader->data + reader->offset;
+    reader->offset += length;
+    return true;
+}
+
+b32 snapshot_read_record(SnapshotReader *reader, SnapshotRecord *record) {
+    return read_bytes(reader, &record->kind, sizeof(record->kind)) &&
+           read_bytes(reader, &record->flags, sizeof(record->flags)) &&
+           read_bytes(reader, &record->rssi, sizeof(record->rssi)) && read_string(reader, &record->path) &&
+           read_string(reader, &record->adapter) && read_string(reader, &record->address) &&
+           read_string(reader, &record->name) && read_string(reader, &record->icon);
+}
+
+internal b32 read_fully(int fd, void *buf, u32 size, i64 deadline) {
+    u8 *p = buf;
+    while (size) {
+        if (deadline) {
+            i64 remaining = deadline - g_get_monotonic_time();
+            struct pollfd pfd = {.fd = fd, .events = POLLIN};
+            if (remaining <= 0)
+                return false;
+            int ready = poll(&pfd, 1, (int)((remaining + 999) / 1000));
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready <= 0)
+                return false;
+        }
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && (errno == EINTR || (errno == EAGAIN && deadline)))
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads one frame from the socket, which may be non-blocking when a
+// deadline is given. The payload is g_malloc'd and owned by the caller.
+b32 snapshot_read_frame(int fd, SnapshotHeader *header, u8 **payload, i64 deadline) {
+    *payload = NULL;
+    if (!read_fully(fd, header, sizeof(*header), deadline) || !snapshot_header_valid(header))
+        return false;
+
+    *payload = g_malloc(header->length ? header->length : 1);
+    if (!read_fully(fd, *payload, header->length, deadline)) {
+        g_free(*payload);
+        *payload = NULL;
+        return false;
+    }
+    return true;
+}
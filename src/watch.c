@@ -19,6 +19,8 @@
 #include <dbus/dbus.h>
 
 #include "gdbus.h"
+#include "memstat.h"
+#include "probes.h"
 
 #define info(fmt...)
 #define error(fmt...)
@@ -201,18 +203,19 @@ static void filter_data_free(struct filter_data *data)
 									NULL);
 
 	for (l = data->callbacks; l != NULL; l = l->next)
-		g_free(l->data);
+		memstat_free(MEMSTAT_WATCH_CALLBACK, l->data,
+					sizeof(struct filter_callback));
 
 	g_slist_free(data->callbacks);
 	g_dbus_remove_watch(data->connection, data->name_watch);
-	g_free(data->name);
-	g_free(data->owner);
-	g_free(data->path);
-	g_free(data->interface);
-	g_free(data->member);
-	g_free(data->argument);
+	memstat_free_string(MEMSTAT_WATCH, data->name);
+	memstat_free_string(MEMSTAT_WATCH, data->owner);
+	memstat_free_string(MEMSTAT_WATCH, data->path);
+	memstat_free_string(MEMSTAT_WATCH, data->interface);
+	memstat_free_string(MEMSTAT_WATCH, data->member);
+	memstat_free_string(MEMSTAT_WATCH, data->argument);
 	dbus_connection_unref(data->connection);
-	g_free(data);
+	memstat_free(MEMSTAT_WATCH, data, sizeof(*data));
 }
 
 static struct filter_data *filter_data_get(DBusConnection *connection,
@@ -248,15 +251,15 @@ proceed:
 	if (data)
 		return data;
 
-	data = g_new0(struct filter_data, 1);
+	data = memstat_alloc0(MEMSTAT_WATCH, sizeof(*data));
 
 	data->connection = dbus_connection_ref(connection);
-	data->name = g_strdup(name);
-	data->owner = g_strdup(owner);
-	data->path = g_strdup(path);
-	data->interface = g_strdup(interface);
-	data->member = g_strdup(member);
-	data->argument = g_strdup(argument);
+	data->name = memstat_strdup(MEMSTAT_WATCH, name);
+	data->owner = memstat_strdup(MEMSTAT_WATCH, owner);
+	data->path = memstat_strdup(MEMSTAT_WATCH, path);
+	data->interface = memstat_strdup(MEMSTAT_WATCH, interface);
+	data->member = memstat_strdup(MEMSTAT_WATCH, member);
+	data->argument = memstat_strdup(MEMSTAT_WATCH, argument);
 
 	if (!add_match(data, filter)) {
 		filter_data_free(data);
@@ -298,9 +301,13 @@ static void filter_data_call_and_free(struct filter_data *data)
 			cb->disc_func(data->connection, cb->user_data);
 		if (cb->destroy_func)
 			cb->destroy_func(cb->user_data);
-		g_free(cb);
+		memstat_free(MEMSTAT_WATCH_CALLBACK, cb, sizeof(*cb));
 	}
 
+	/* filter_data_free would free the callbacks a second time */
+	g_slist_free(data->callbacks);
+	data->callbacks = NULL;
+
 	filter_data_free(data);
 }
 
@@ -314,7 +321,7 @@ static struct filter_callback *filter_data_add_callback(
 {
 	struct filter_callback *cb = NULL;
 
-	cb = g_new0(struct filter_callback, 1);
+	cb = memstat_alloc0(MEMSTAT_WATCH_CALLBACK, sizeof(*cb));
 
 	cb->conn_func = connect;
 	cb->disc_func = disconnect;
@@ -344,7 +351,7 @@ static void service_data_free(struct service_data *data)
 		g_source_remove(data->id);
 
 	g_free(data->name);
-	g_free(data);
+	memstat_free(MEMSTAT_WATCH_CALLBACK, data, sizeof(*data));
 
 	callback->data = NULL;
 }
@@ -366,7 +373,7 @@ static gboolean filter_data_remove_callback(struct filter_data *data,
 	if (cb->destroy_func)
 		cb->destroy_func(cb->user_data);
 
-	g_free(cb);
+	memstat_free(MEMSTAT_WATCH_CALLBACK, cb, sizeof(*cb));
 
 	/* Don't remove the filter if other callbacks exist or data is lock
 	 * processing callbacks */
@@ -421,8 +428,8 @@ static void update_name_cache(const char *name, const char *owner)
 		if (g_strcmp0(data->name, name) != 0)
 			continue;
 
-		g_free(data->owner);
-		data->owner = g_strdup(owner);
+		memstat_free_string(MEMSTAT_WATCH, data->owner);
+		data->owner = memstat_strdup(MEMSTAT_WATCH, owner);
 	}
 }
 
@@ -510,6 +517,8 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 	member = dbus_message_get_member(message);
 	dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &arg, DBUS_TYPE_INVALID);
 
+	PROBE2(signal_begin, path, member);
+
 	/* If sender != NULL it is always the owner */
 
 	for (current = listeners; current != NULL; current = current->next) {
@@ -553,8 +562,10 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 								current);
 	}
 
-	if (delete_listener == NULL)
+	if (delete_listener == NULL) {
+		PROBE1(signal_end, member);
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
 
 	for (current = delete_listener; current != NULL;
 					current = delete_listener->next) {
@@ -574,6 +585,8 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 
 	g_slist_free(delete_listener);
 
+	PROBE1(signal_end, member);
+
 	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
@@ -633,11 +646,7 @@ static void check_service(DBusConnection *connection,
 	DBusMessage *message;
 	struct service_data *data;
 
-	data = g_try_malloc0(sizeof(*data));
-	if (data == NULL) {
-		error("Can't allocate data structure");
-		return;
-	}
+	data = memstat_alloc0(MEMSTAT_WATCH_CALLBACK, sizeof(*data));
 
 	data->conn = dbus_connection_ref(connection);
 	data->name = g_strdup(name);
@@ -654,7 +663,7 @@ static void check_service(DBusConnection *connection,
 			DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "GetNameOwner");
 	if (message == NULL) {
 		error("Can't allocate new message");
-		g_free(data);
+		memstat_free(MEMSTAT_WATCH_CALLBACK, data, sizeof(*data));
 		return;
 	}
 
@@ -664,13 +673,13 @@ static void check_service(DBusConnection *connection,
 	if (dbus_connection_send_with_reply(connection, message,
 							&data->call, -1) == FALSE) {
 		error("Failed to execute method call");
-		g_free(data);
+		memstat_free(MEMSTAT_WATCH_CALLBACK, data, sizeof(*data));
 		goto done;
 	}
 
 	if (data->call == NULL) {
 		error("D-Bus connection not available");
-		g_free(data);
+		memstat_free(MEMSTAT_WATCH_CALLBACK, data, sizeof(*data));
 		goto done;
 	}
 